@@ -0,0 +1,811 @@
+/// \file pivot_bench.cpp
+/// \brief Checks and measures pivot and unpivot against the local SDK stand-in
+///
+/// pivot_bench check runs fixed cases through the full command sequence and compares the output rows.
+/// pivot_bench [groups [keys]] also pivots synthetic data, each group holding one row per key, in every LOOKUP mode
+/// and reports rows/sec, ns/row and heap allocations/row over the Create ... Destroy commands.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "vdb_udf.hpp"
+#include "udf_host.hpp"
+
+extern "C" void pivot(vdb_udf::TableArg &arg);
+extern "C" void unpivot(vdb_udf::TableArg &arg);
+
+uint64_t udfHostAllocations = 0;
+
+// Every replaceable form of new and delete, so that nothing allocated here is freed by another allocator
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    udfHostAllocations++;
+    return malloc(size ? size : 1);
+}
+
+void *operator new(std::size_t size)
+{
+    void *p = operator new(size, std::nothrow);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+static vdb_udf::Column column(vdb_udf::int_t type, const char *name, vdb_udf::int_t scale = 0)
+{
+    vdb_udf::Column c = { type, (type == vdb_udf::TypeVarChar) ? 32 : 8, true, (type == vdb_udf::TypeNumeric) ? 18 : 0,
+                          scale, name };
+    return c;
+}
+
+/// A row from text fields: "NULL" is NULL, a field is a string for a string column and a number otherwise
+static vdb_udf::RowDesc row(const std::vector<vdb_udf::Column> &cols, const std::vector<std::string> &fields)
+{
+    vdb_udf::RowDesc r;
+
+    for (std::size_t c = 0; c < fields.size(); c++)
+    {
+        const std::string &f = fields[c];
+        if (f == "NULL")
+            r.setNull(c, true);
+        else if (cols[c].type == vdb_udf::TypeVarChar)
+            r.setVarChar(c, f.data(), f.size());
+        else if (cols[c].type == vdb_udf::TypeFloat8)
+            r.setFloat8(c, atof(f.c_str()));
+        else if (cols[c].type == vdb_udf::TypeFloat4)
+            r.setFloat4(c, (vdb_udf::float4_t) atof(f.c_str()));
+        else if (cols[c].type == vdb_udf::TypeNumeric)
+            r.setNumeric(c, atoll(f.c_str()));
+        else if (cols[c].type == vdb_udf::TypeDate)
+            r.setDate(c, atoi(f.c_str()));
+        else if (cols[c].type == vdb_udf::TypeTimeStamp)
+            r.setTimeStamp(c, atoll(f.c_str()));
+        else if (cols[c].type == vdb_udf::TypeBigInt)
+            r.setBigInt(c, atoll(f.c_str()));
+        else
+            r.setInt(c, atoi(f.c_str()));
+    }
+    return r;
+}
+
+/// A pivot or unpivot statement: input columns, named parameters, COLUMN_LIST result and input rows
+struct Case
+{
+    const char *m_name;
+    void (*m_udf)(vdb_udf::TableArg &);
+    vdb_udf::TableArg m_arg;
+    std::vector<vdb_udf::Column> m_in;
+    std::vector<vdb_udf::RowDesc> m_rows;
+
+    Case(const char *name, void (*udf)(vdb_udf::TableArg &), const std::vector<vdb_udf::Column> &in) :
+        m_name(name), m_udf(udf), m_in(in)
+    {
+        for (std::size_t c = 0; c < in.size(); c++)
+            m_arg.addInputColumn(in[c].type, in[c].length, in[c].name.c_str(), in[c].precision, in[c].scale);
+        m_arg.setConst("column_list", "select key, name from column_list");
+    }
+
+    Case &colRef(const char *name, const vdb_udf::ColumnIndexVector &cols)
+    {
+        m_arg.setColRef(name, cols);
+        return *this;
+    }
+
+    Case &param(const char *name, const char *value)
+    {
+        m_arg.setConst(name, value);
+        return *this;
+    }
+
+    Case &columnList(const std::vector<vdb_udf::Column> &schema, const std::vector<std::vector<std::string> > &rows)
+    {
+        std::vector<vdb_udf::RowDesc> result;
+        for (std::size_t r = 0; r < rows.size(); r++)
+            result.push_back(row(schema, rows[r]));
+        m_arg.setQueryResult(schema, result);
+        return *this;
+    }
+
+    Case &input(const std::vector<std::vector<std::string> > &rows)
+    {
+        for (std::size_t r = 0; r < rows.size(); r++)
+            m_rows.push_back(row(m_in, rows[r]));
+        return *this;
+    }
+
+    /// Run the statement and return its output, header line first, or "error: " and the message of the error
+    /// raised by the function
+    std::vector<std::string> output()
+    {
+        std::vector<std::string> got;
+
+        try
+        {
+            runTable(m_udf, m_arg, m_rows);
+            std::string header;
+            std::vector<vdb_udf::Column> &out = m_arg.outputColumns();
+            for (std::size_t c = 0; c < out.size(); c++)
+                header += (c ? "\t" : "") + out[c].name;
+            got.push_back(header);
+            std::vector<vdb_udf::RowDesc> &rows = m_arg.getRowStore().rows();
+            for (std::size_t r = 0; r < rows.size(); r++)
+                got.push_back(formatRow(rows[r], out.size()));
+        }
+        catch (std::exception &e)
+        {
+            got.assign(1, std::string("error: ") + e.what());
+        }
+        return got;
+    }
+
+    /// Run the statement and compare its output with expected
+    bool expect(const std::vector<std::string> &expected)
+    {
+        std::vector<std::string> got = output();
+
+        if (got == expected)
+            return true;
+        printf("FAIL %s\n  expected:\n", m_name);
+        for (std::size_t i = 0; i < expected.size(); i++)
+            printf("    %s\n", expected[i].c_str());
+        printf("  got:\n");
+        for (std::size_t i = 0; i < got.size(); i++)
+            printf("    %s\n", got[i].c_str());
+        return false;
+    }
+};
+
+static std::vector<vdb_udf::Column> pivotInput(vdb_udf::int_t keyType, vdb_udf::int_t valType = vdb_udf::TypeInt)
+{
+    std::vector<vdb_udf::Column> in;
+    in.push_back(column(vdb_udf::TypeInt, "g"));
+    in.push_back(column(keyType, "k"));
+    in.push_back(column(valType, "v"));
+    return in;
+}
+
+static Case &pivotCase(Case &c)
+{
+    vdb_udf::ColumnIndexVector g(1, 0), k(1, 1), v(1, 2);
+    return c.colRef("groupcol", g).colRef("pivotcol", k).colRef("pivotval", v);
+}
+
+static std::vector<vdb_udf::Column> listSchema(vdb_udf::int_t keyType)
+{
+    std::vector<vdb_udf::Column> schema;
+    schema.push_back(column(keyType, "key"));
+    schema.push_back(column(vdb_udf::TypeVarChar, "name"));
+    return schema;
+}
+
+/// Run one command of a statement; the text of the error it raised, or an empty string
+static std::string command(Case &c, vdb_udf::Command cmd)
+{
+    try
+    {
+        c.m_arg.setCommand(cmd);
+        c.m_udf(c.m_arg);
+    }
+    catch (std::exception &e)
+    {
+        return e.what();
+    }
+    return "";
+}
+
+/// Create must reject session data whose key map blob was cut short, damaged or written by another map version.
+/// The session data is the blob size, its identity in two words, and the blob with its length; the blob starts
+/// with the map magic and version.
+static int checkSession()
+{
+    const char *damages[] = { "truncated", "checksum", "version" };
+    const std::string rejected = "PivotClass: pivot key map session data is damaged or from an incompatible version";
+    int failed = 0;
+
+    for (std::size_t d = 0; d < sizeof(damages) / sizeof(damages[0]); d++)
+    {
+        Case c(damages[d], pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(c).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" } });
+        std::string err = command(c, vdb_udf::Describe);
+        err += command(c, vdb_udf::Start);
+
+        std::string &session = c.m_arg.sessionData();
+        const std::size_t blobAt = 4 * sizeof(vdb_udf::int_t);
+        vdb_udf::int_t size = (vdb_udf::int_t) (session.size() - blobAt);
+        if (d == 0)
+        {
+            size -= 8;
+            session.resize(session.size() - 8);
+            memcpy(&session[0], &size, sizeof(size));
+            memcpy(&session[3 * sizeof(vdb_udf::int_t)], &size, sizeof(size));
+        }
+        else if (d == 1)
+            session[session.size() - 1] ^= 1;
+        else
+            session[blobAt + sizeof(uint32_t)] ^= 1;
+
+        std::string create = command(c, vdb_udf::Create);
+        if (!err.empty() || create != rejected)
+        {
+            printf("FAIL %s session data: %s / %s\n", damages[d], err.c_str(), create.c_str());
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/// Heap allocations made by the Create command of c
+static uint64_t createAllocations(Case &c)
+{
+    uint64_t before = udfHostAllocations;
+    std::string err = command(c, vdb_udf::Create);
+
+    if (!err.empty())
+        printf("FAIL %s: %s\n", c.m_name, err.c_str());
+    return udfHostAllocations - before;
+}
+
+/// Functors whose session data holds the same key map blob share one copy of the map while any of them lives.
+/// The sharing shows in the allocations of Create, which reads the blob only when it finds no live copy.
+static int checkSharing()
+{
+    const std::vector<std::vector<std::string> > list = { { "10", "a" }, { "20", "b" } };
+    Case a("shared map a", pivot, pivotInput(vdb_udf::TypeInt)), b("shared map b", pivot, pivotInput(vdb_udf::TypeInt));
+    Case c("other map", pivot, pivotInput(vdb_udf::TypeInt));
+    pivotCase(a).columnList(listSchema(vdb_udf::TypeInt), list);
+    pivotCase(b).columnList(listSchema(vdb_udf::TypeInt), list);
+    pivotCase(c).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "30", "b" } });
+    std::string err;
+    int failed = 0;
+
+    for (Case *s : { &a, &b, &c })
+    {
+        err += command(*s, vdb_udf::Describe);
+        err += command(*s, vdb_udf::Start);
+    }
+
+    uint64_t read = createAllocations(a);
+    uint64_t shared = createAllocations(b);
+    uint64_t other = createAllocations(c);
+    c.m_arg.destroyFunctor();
+    // Once the last functor holding the map is gone, the next Create reads the blob again
+    a.m_arg.destroyFunctor();
+    b.m_arg.destroyFunctor();
+    uint64_t again = createAllocations(b);
+    b.m_arg.destroyFunctor();
+
+    if (!err.empty() || shared >= read || other != read || again != read)
+    {
+        printf("FAIL shared map: %s, %llu allocations to read, %llu shared, %llu other, %llu after release\n", err.c_str(),
+               (unsigned long long) read, (unsigned long long) shared, (unsigned long long) other, (unsigned long long) again);
+        failed++;
+    }
+    return failed;
+}
+
+/// PHASE 'partial' on two slices followed by 'merge' must give what PHASE 'single' gives, for every aggregate.
+/// Group 3 only has rows on the second slice, key 30 none in group 2 and key 40 none at all.
+static int checkMerge()
+{
+    const char *ops[] = { "sum", "count", "min", "max", "avg" };
+    const std::vector<std::vector<std::string> > list = { { "10", "a" }, { "20", "b" }, { "30", "c" }, { "40", "d" } };
+    const std::vector<std::vector<std::string> > slice1 = { { "1", "10", "5" }, { "1", "20", "NULL" }, { "2", "10", "-3" },
+                                                             { "1", "30", "7" } };
+    const std::vector<std::vector<std::string> > slice2 = { { "1", "10", "6" }, { "2", "20", "8" }, { "3", "30", "1" },
+                                                             { "2", "10", "4" }, { "3", "30", "2" } };
+    int failed = 0;
+
+    for (std::size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++)
+    {
+        Case single(ops[o], pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(single).param("aggregate", ops[o]).columnList(listSchema(vdb_udf::TypeInt), list).input(slice1).input(slice2);
+        std::vector<std::string> want = single.output();
+
+        Case partial1(ops[o], pivot, pivotInput(vdb_udf::TypeInt)), partial2(ops[o], pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(partial1).param("aggregate", ops[o]).param("phase", "partial").columnList(listSchema(vdb_udf::TypeInt), list).input(slice1);
+        pivotCase(partial2).param("aggregate", ops[o]).param("phase", "partial").columnList(listSchema(vdb_udf::TypeInt), list).input(slice2);
+        partial1.output();
+        partial2.output();
+
+        Case merge(ops[o], pivot, partial1.m_arg.outputColumns());
+        vdb_udf::ColumnIndexVector g(1, 0);
+        merge.colRef("groupcol", g).param("aggregate", ops[o]).param("phase", "merge").columnList(listSchema(vdb_udf::TypeInt), list);
+        merge.m_rows = partial1.m_arg.getRowStore().rows();
+        merge.m_rows.insert(merge.m_rows.end(), partial2.m_arg.getRowStore().rows().begin(), partial2.m_arg.getRowStore().rows().end());
+        std::string name = std::string("partial and merge ") + ops[o];
+        merge.m_name = name.c_str();
+        failed += !merge.expect(want);
+    }
+
+    // A merge input that is not the output of a partial pivot over the same COLUMN_LIST
+    {
+        std::vector<vdb_udf::Column> in;
+        in.push_back(column(vdb_udf::TypeInt, "g"));
+        in.push_back(column(vdb_udf::TypeBigInt, "a"));
+        in.push_back(column(vdb_udf::TypeBigInt, "a_count"));
+        vdb_udf::ColumnIndexVector g(1, 0);
+        Case c("merge too few columns", pivot, in);
+        c.colRef("groupcol", g).param("aggregate", "sum").param("phase", "merge").columnList(listSchema(vdb_udf::TypeInt), list);
+        failed += !c.expect({ "error: validateMerge: the input has 3 columns, a partial pivot of 4 keys has 9" });
+
+        in.resize(9, column(vdb_udf::TypeBigInt, "x"));
+        in[4] = column(vdb_udf::TypeInt, "b_count");
+        Case t("merge count type", pivot, in);
+        t.colRef("groupcol", g).param("aggregate", "sum").param("phase", "merge").columnList(listSchema(vdb_udf::TypeInt), list);
+        failed += !t.expect({ "error: validateMerge: input column 4 must be the bigint count of a partial pivot cell" });
+
+        in[4] = column(vdb_udf::TypeBigInt, "b_count");
+        in[5] = column(vdb_udf::TypeFloat8, "c");
+        Case s("merge state type", pivot, in);
+        s.colRef("groupcol", g).param("aggregate", "sum").param("phase", "merge").columnList(listSchema(vdb_udf::TypeInt), list);
+        failed += !s.expect({ "error: validateMerge: input column 5 must have the type of input column 1, the state of the same value column" });
+
+        in[5] = column(vdb_udf::TypeBigInt, "c");
+        in.push_back(column(vdb_udf::TypeBigInt, "extra"));
+        Case x("merge extra column", pivot, in);
+        x.colRef("groupcol", g).param("aggregate", "sum").param("phase", "merge").columnList(listSchema(vdb_udf::TypeInt), list);
+        failed += !x.expect({ "error: validateMerge: the input has more than the 9 columns of a partial pivot of 4 keys" });
+
+        in.pop_back();
+        in[1] = column(vdb_udf::TypeDate, "a");
+        for (std::size_t c = 3; c < 9; c += 2)
+            in[c] = column(vdb_udf::TypeDate, "s");
+        Case d("merge state of count", pivot, in);
+        d.colRef("groupcol", g).param("aggregate", "count").param("phase", "merge").columnList(listSchema(vdb_udf::TypeInt), list);
+        failed += !d.expect({ "error: validateMerge: input column 1 does not hold the partial state of 'aggregate' entry 0" });
+
+        vdb_udf::ColumnIndexVector late(1, 1);
+        Case l("merge group columns", pivot, in);
+        l.colRef("groupcol", late).param("aggregate", "count").param("phase", "merge").columnList(listSchema(vdb_udf::TypeInt), list);
+        failed += !l.expect({ "error: validateMerge: 'groupcol' must name the leading input columns when 'phase' is 'merge'" });
+    }
+    return failed;
+}
+
+static int check()
+{
+    int failed = 0;
+    const char *modes[] = { "auto", "hash", "dense", "perfect", "sorted" };
+
+    for (std::size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        Case c(modes[m], pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(c).param("lookup", modes[m])
+            .columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" }, { "30", "c" } })
+            .input({ { "1", "10", "100" }, { "1", "30", "300" }, { "2", "20", "200" } });
+        failed += !c.expect({ "g\ta\tb\tc", "1\t100\tNULL\t300", "2\tNULL\t200\tNULL" });
+    }
+    {
+        Case c("varchar keys", pivot, pivotInput(vdb_udf::TypeVarChar));
+        pivotCase(c).columnList(listSchema(vdb_udf::TypeVarChar), { { "x", "a" }, { "yy", "b" } })
+            .input({ { "1", "yy", "5" }, { "2", "x", "6" } });
+        failed += !c.expect({ "g\ta\tb", "1\tNULL\t5", "2\t6\tNULL" });
+    }
+    {
+        // Float keys match at the width of the PIVOTCOL column; -0 is 0 and NaN is NaN
+        Case c("float4 keys", pivot, pivotInput(vdb_udf::TypeFloat4));
+        pivotCase(c).columnList(listSchema(vdb_udf::TypeFloat4), { { "0.1", "a" }, { "0", "b" }, { "nan", "c" } })
+            .input({ { "1", "0.1", "5" }, { "2", "-0", "6" }, { "3", "nan", "7" } });
+        failed += !c.expect({ "g\ta\tb\tc", "1\t5\tNULL\tNULL", "2\tNULL\t6\tNULL", "3\tNULL\tNULL\t7" });
+
+        Case d("float8 keys", pivot, pivotInput(vdb_udf::TypeFloat8));
+        pivotCase(d).columnList(listSchema(vdb_udf::TypeFloat8), { { "0.1", "a" }, { "-0", "b" }, { "-nan", "c" } })
+            .input({ { "1", "0.1", "5" }, { "2", "0", "6" }, { "3", "nan", "7" } });
+        failed += !d.expect({ "g\ta\tb\tc", "1\t5\tNULL\tNULL", "2\tNULL\t6\tNULL", "3\tNULL\tNULL\t7" });
+
+        Case e("float4 pivotcol float8 keys", pivot, pivotInput(vdb_udf::TypeFloat4));
+        pivotCase(e).columnList(listSchema(vdb_udf::TypeFloat8), { { "0.1", "a" } }).input({ { "1", "0.1", "5" } });
+        failed += !e.expect({ "error: DescribeCmd: invalid column description query, column 0 must be a float4 like 'pivotcol' column 0" });
+
+        Case f("float8 pivotcol float4 keys", pivot, pivotInput(vdb_udf::TypeFloat8));
+        pivotCase(f).columnList(listSchema(vdb_udf::TypeFloat4), { { "0.1", "a" } }).input({ { "1", "0.1", "5" } });
+        failed += !f.expect({ "error: DescribeCmd: invalid column description query, column 0 must be a float8 like 'pivotcol' column 0" });
+    }
+    {
+        // A multi-column PIVOTCOL matches every component, each with its own type
+        std::vector<vdb_udf::Column> in = pivotInput(vdb_udf::TypeInt);
+        in.insert(in.begin() + 2, column(vdb_udf::TypeVarChar, "k2"));
+        std::vector<vdb_udf::Column> schema = listSchema(vdb_udf::TypeInt);
+        schema.insert(schema.begin() + 1, column(vdb_udf::TypeVarChar, "key2"));
+        vdb_udf::ColumnIndexVector g(1, 0), k, v(1, 3);
+        k.push_back(1);
+        k.push_back(2);
+        const std::vector<std::vector<std::string> > list = { { "10", "x", "a" }, { "10", "yy", "b" }, { "20", "x", "c" } };
+
+        Case c("composite keys", pivot, in);
+        c.colRef("groupcol", g).colRef("pivotcol", k).colRef("pivotval", v).columnList(schema, list)
+            .input({ { "1", "10", "yy", "5" }, { "1", "20", "x", "6" }, { "2", "10", "x", "7" } });
+        failed += !c.expect({ "g\ta\tb\tc", "1\tNULL\t5\t6", "2\t7\tNULL\tNULL" });
+
+        // Each component is in the map, but not the pair
+        Case m("composite missing key", pivot, in);
+        m.colRef("groupcol", g).colRef("pivotcol", k).colRef("pivotval", v).columnList(schema, list)
+            .input({ { "1", "20", "yy", "5" } });
+        failed += !m.expect({ "error: missingKey: Unexpected failure in finding pivotkey (20, yy) in map" });
+
+        // The components must follow the PIVOTCOL types in order
+        std::vector<vdb_udf::Column> swapped = schema;
+        std::swap(swapped[0], swapped[1]);
+        Case t("composite key order", pivot, in);
+        t.colRef("groupcol", g).colRef("pivotcol", k).colRef("pivotval", v).columnList(swapped, { { "x", "10", "a" } })
+            .input({ { "1", "10", "x", "5" } });
+        failed += !t.expect({ "error: DescribeCmd: invalid column description query, column 0 must have the same type family as 'pivotcol' column 0" });
+    }
+    {
+        // BUCKET rounds a timestamp down to a multiple of its seconds from BUCKET_BASE, earlier values included.
+        // Timestamps are microseconds and dates days from 2000-01-01.
+        Case c("bucket seconds", pivot, pivotInput(vdb_udf::TypeTimeStamp));
+        pivotCase(c).param("bucket", "60").param("bucket_base", "2000-01-01 00:00:30").param("aggregate", "sum")
+            .columnList(listSchema(vdb_udf::TypeTimeStamp), { { "30000000", "a" }, { "90000000", "b" }, { "-30000000", "c" } })
+            .input({ { "1", "45000000", "1" }, { "1", "90000000", "2" }, { "1", "149999999", "3" },
+                     { "2", "29999999", "4" }, { "2", "-30000000", "5" } });
+        failed += !c.expect({ "g\ta\tb\tc", "1\t1\t5\tNULL", "2\tNULL\tNULL\t9" });
+
+        // 'month' maps a date or a timestamp to the last day of its month: 2000-01-31, 2000-02-29 and 1999-12-31
+        std::vector<std::vector<std::string> > months = { { "30", "jan" }, { "59", "feb" }, { "-1", "dec" } };
+        Case d("bucket month of date", pivot, pivotInput(vdb_udf::TypeDate));
+        pivotCase(d).param("bucket", "month").columnList(listSchema(vdb_udf::TypeDate), months)
+            .input({ { "1", "0", "1" }, { "1", "45", "2" }, { "2", "-10", "3" } });
+        failed += !d.expect({ "g\tjan\tfeb\tdec", "1\t1\t2\tNULL", "2\tNULL\tNULL\t3" });
+
+        Case t("bucket month of timestamp", pivot, pivotInput(vdb_udf::TypeTimeStamp));
+        pivotCase(t).param("bucket", "month").columnList(listSchema(vdb_udf::TypeDate), months)
+            .input({ { "1", "2592000000001", "1" }, { "1", "2678400000000", "2" }, { "2", "-1", "3" } });
+        failed += !t.expect({ "g\tjan\tfeb\tdec", "1\t1\t2\tNULL", "2\tNULL\tNULL\t3" });
+
+        // COLUMN_LIST holds timestamps for an interval and dates for 'month'
+        Case i("bucket seconds date keys", pivot, pivotInput(vdb_udf::TypeTimeStamp));
+        pivotCase(i).param("bucket", "60").columnList(listSchema(vdb_udf::TypeDate), months).input({ { "1", "0", "1" } });
+        failed += !i.expect({ "error: DescribeCmd: invalid column description query, column 0 must be a timestamp for this 'bucket'" });
+
+        Case m("bucket month timestamp keys", pivot, pivotInput(vdb_udf::TypeTimeStamp));
+        pivotCase(m).param("bucket", "month").columnList(listSchema(vdb_udf::TypeTimeStamp), months).input({ { "1", "0", "1" } });
+        failed += !m.expect({ "error: DescribeCmd: invalid column description query, column 0 must be a date for this 'bucket'" });
+    }
+    {
+        // A repeated key keeps the column of its first row; the later column stays NULL
+        Case c("repeated key", pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(c).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "10", "b" }, { "30", "c" } })
+            .input({ { "1", "30", "300" }, { "2", "10", "100" } });
+        failed += !c.expect({ "g\ta\tb\tc", "1\tNULL\tNULL\t300", "2\t100\tNULL\tNULL" });
+    }
+    {
+        Case c("sum", pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(c).param("aggregate", "sum")
+            .columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "10", "b" }, { "30", "c" } })
+            .input({ { "1", "30", "300" }, { "1", "30", "5" }, { "1", "10", "NULL" }, { "2", "10", "100" } });
+        failed += !c.expect({ "g\ta\tb\tc", "1\tNULL\tNULL\t305", "2\t100\tNULL\tNULL" });
+    }
+    {
+        // Numeric keys are compared at the COLUMN_LIST scale, whichever side has more digits
+        std::vector<vdb_udf::Column> schema;
+        schema.push_back(column(vdb_udf::TypeNumeric, "key", 2));
+        schema.push_back(column(vdb_udf::TypeVarChar, "name"));
+        Case up("numeric key scaled up", pivot, pivotInput(vdb_udf::TypeNumeric));
+        pivotCase(up).columnList(schema, { { "1050", "a" }, { "2000", "b" } })
+            .input({ { "1", "20", "7" }, { "2", "20", "8" } });
+        failed += !up.expect({ "g\ta\tb", "1\tNULL\t7", "2\tNULL\t8" });
+
+        std::vector<vdb_udf::Column> in = pivotInput(vdb_udf::TypeNumeric);
+        in[1].scale = 3;
+        schema[0].scale = 1;
+        Case down("numeric key scaled down", pivot, in);
+        pivotCase(down).columnList(schema, { { "105", "a" }, { "200", "b" } })
+            .input({ { "1", "10500", "7" }, { "2", "20000", "9" } });
+        failed += !down.expect({ "g\ta\tb", "1\t7\tNULL", "2\tNULL\t9" });
+    }
+    {
+        Case c("numeric avg", pivot, pivotInput(vdb_udf::TypeInt, vdb_udf::TypeNumeric));
+        pivotCase(c).param("aggregate", "avg")
+            .columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" } })
+            .input({ { "1", "10", "100" }, { "1", "10", "101" }, { "1", "20", "-100" }, { "1", "20", "-101" } });
+        failed += !c.expect({ "g\ta\tb", "1\t101\t-101" });
+    }
+    {
+        Case c("bigint sum overflow", pivot, pivotInput(vdb_udf::TypeInt, vdb_udf::TypeBigInt));
+        pivotCase(c).param("aggregate", "sum")
+            .columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" } })
+            .input({ { "1", "10", "9223372036854775807" }, { "1", "10", "1" } });
+        failed += !c.expect({ "error: sumOverflow: sum of 'pivotval' column 0 overflows bigint" });
+    }
+    {
+        Case c("bigint sum at the limit", pivot, pivotInput(vdb_udf::TypeInt, vdb_udf::TypeBigInt));
+        pivotCase(c).param("aggregate", "sum")
+            .columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" } })
+            .input({ { "1", "10", "9223372036854775807" }, { "1", "10", "-1" }, { "1", "10", "1" } });
+        failed += !c.expect({ "g\ta", "1\t9223372036854775807" });
+    }
+    {
+        Case c("date sum", pivot, pivotInput(vdb_udf::TypeInt, vdb_udf::TypeDate));
+        pivotCase(c).param("aggregate", "sum")
+            .columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" } })
+            .input({ { "1", "10", "3" } });
+        failed += !c.expect({ "error: validate: 'pivotval' column 0 must be an integer, float or numeric column for 'sum' and 'avg'" });
+    }
+    {
+        Case c("packed", pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(c).param("output", "packed")
+            .columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" }, { "30", "c" } })
+            .input({ { "1", "30", "300" }, { "1", "10", "100" }, { "2", "20", "200" } });
+        failed += !c.expect({ "g\tcells", "1\t0:100,2:300", "2\t1:200" });
+    }
+    {
+        Case c("stream", pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(c).param("grouping", "stream")
+            .columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" } })
+            .input({ { "2", "20", "200" }, { "1", "10", "100" }, { "2", "10", "201" } });
+        failed += !c.expect({ "g\ta\tb", "1\t100\tNULL", "2\t201\t200" });
+    }
+    {
+        std::vector<vdb_udf::Column> in;
+        in.push_back(column(vdb_udf::TypeInt, "g"));
+        in.push_back(column(vdb_udf::TypeInt, "c0"));
+        in.push_back(column(vdb_udf::TypeInt, "c1"));
+        vdb_udf::ColumnIndexVector g(1, 0), v;
+        v.push_back(1);
+        v.push_back(2);
+        Case c("unpivot", unpivot, in);
+        c.colRef("groupcol", g).colRef("pivotval", v)
+            .columnList(listSchema(vdb_udf::TypeVarChar), { { "a", "x" }, { "b", "y" } })
+            .input({ { "1", "10", "NULL" }, { "2", "20", "21" } });
+        failed += !c.expect({ "g\tkey\tvalue", "1\ta\t10", "2\ta\t20", "2\tb\t21" });
+    }
+    {
+        std::vector<vdb_udf::Column> in;
+        in.push_back(column(vdb_udf::TypeInt, "g"));
+        in.push_back(column(vdb_udf::TypeInt, "c0"));
+        in.push_back(column(vdb_udf::TypeInt, "c1"));
+        vdb_udf::ColumnIndexVector g(1, 0), v;
+        v.push_back(1);
+        v.push_back(2);
+        Case c("unpivot repeated key", unpivot, in);
+        c.colRef("groupcol", g).colRef("pivotval", v)
+            .columnList(listSchema(vdb_udf::TypeVarChar), { { "a", "x" }, { "a", "y" } })
+            .input({ { "1", "10", "20" } });
+        failed += !c.expect({ "error: DescribeCmd: column description query returned 1 distinct keys for 2 'pivotval' columns" });
+    }
+    {
+        // The value column is as wide as the widest PIVOTVAL column
+        std::vector<vdb_udf::Column> in;
+        in.push_back(column(vdb_udf::TypeInt, "g"));
+        in.push_back(column(vdb_udf::TypeVarChar, "c0"));
+        in.push_back(column(vdb_udf::TypeVarChar, "c1"));
+        in[2].length = 100;
+        vdb_udf::ColumnIndexVector g(1, 0), v;
+        v.push_back(1);
+        v.push_back(2);
+        Case c("unpivot value length", unpivot, in);
+        c.colRef("groupcol", g).colRef("pivotval", v)
+            .columnList(listSchema(vdb_udf::TypeVarChar), { { "a", "x" }, { "b", "y" } })
+            .input({ { "1", "p", "q" } });
+        failed += !c.expect({ "g\tkey\tvalue", "1\ta\tp", "1\tb\tq" });
+        if (c.m_arg.outputColumns()[2].length != 100)
+        {
+            printf("FAIL unpivot value length: %d\n", c.m_arg.outputColumns()[2].length);
+            failed++;
+        }
+    }
+
+    {
+        // Statements planned at the same time with the same COLUMN_LIST result share the handoff, and Start does
+        // not run the query again
+        Case a("same handoff a", pivot, pivotInput(vdb_udf::TypeInt)), b("same handoff b", pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(a).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" } });
+        pivotCase(b).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" } });
+        std::string err = command(a, vdb_udf::Describe);
+        err += command(b, vdb_udf::Describe);
+        err += command(b, vdb_udf::Start);
+        err += command(a, vdb_udf::Start);
+        if (!err.empty() || a.m_arg.m_query_runs != 1 || b.m_arg.m_query_runs != 1)
+        {
+            printf("FAIL same handoff: %s, %d and %d query runs\n", err.c_str(), a.m_arg.m_query_runs, b.m_arg.m_query_runs);
+            failed++;
+        }
+    }
+    {
+        // When the result changed between their Describes with the same labels, both handoffs fit each Start, so
+        // each runs the query again rather than guess
+        Case a("changed handoff a", pivot, pivotInput(vdb_udf::TypeInt)), b("changed handoff b", pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(a).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" } });
+        pivotCase(b).columnList(listSchema(vdb_udf::TypeInt), { { "20", "a" }, { "10", "b" } });
+        std::string err = command(a, vdb_udf::Describe);
+        err += command(b, vdb_udf::Describe);
+        err += command(a, vdb_udf::Start);
+        err += command(b, vdb_udf::Start);
+        if (!err.empty() || a.m_arg.m_query_runs != 2 || b.m_arg.m_query_runs != 2)
+        {
+            printf("FAIL changed handoff: %s, %d and %d query runs\n", err.c_str(), a.m_arg.m_query_runs, b.m_arg.m_query_runs);
+            failed++;
+        }
+    }
+    {
+        // A Describe whose Start never came leaves a handoff that no longer fits once the result changed; it must
+        // not fail the statements that follow
+        Case o("orphaned handoff", pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(o).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" } });
+        std::string err = command(o, vdb_udf::Describe);
+        for (int run = 0; run < 5; run++)
+        {
+            Case c("after orphaned handoff", pivot, pivotInput(vdb_udf::TypeInt));
+            pivotCase(c).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" }, { "30", "c" } })
+                .input({ { "1", "30", "300" } });
+            failed += !c.expect({ "g\ta\tb\tc", "1\tNULL\tNULL\t300" });
+            if (c.m_arg.m_query_runs != 1)
+            {
+                printf("FAIL after orphaned handoff: %d query runs\n", c.m_arg.m_query_runs);
+                failed++;
+            }
+        }
+        // Nor when the orphan still fits: the query runs again, and the reruns after it find their own handoff
+        Case p("orphaned same layout", pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(p).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" } });
+        err += command(p, vdb_udf::Describe);
+        for (int run = 0; run < 5; run++)
+        {
+            Case c("after orphaned same layout", pivot, pivotInput(vdb_udf::TypeInt));
+            pivotCase(c).columnList(listSchema(vdb_udf::TypeInt), { { "20", "a" }, { "10", "b" } })
+                .input({ { "1", "10", "100" } });
+            failed += !c.expect({ "g\ta\tb", "1\tNULL\t100" });
+            if (c.m_arg.m_query_runs != (run == 0 ? 2 : 1))
+            {
+                printf("FAIL after orphaned same layout: %d query runs in run %d\n", c.m_arg.m_query_runs, run);
+                failed++;
+            }
+        }
+        if (!err.empty())
+        {
+            printf("FAIL orphaned handoff: %s\n", err.c_str());
+            failed++;
+        }
+    }
+    {
+        // Start raises an error only when the result it reads again no longer gives the columns Describe laid out
+        Case a("changed layout a", pivot, pivotInput(vdb_udf::TypeInt)), b("changed layout b", pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(a).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" } });
+        pivotCase(b).columnList(listSchema(vdb_udf::TypeInt), { { "20", "a" }, { "10", "b" } });
+        std::string err = command(a, vdb_udf::Describe);
+        err += command(b, vdb_udf::Describe);
+        a.columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" }, { "20", "b" }, { "30", "c" } });
+        std::string startA = command(a, vdb_udf::Start);
+        std::string startB = command(b, vdb_udf::Start);
+        if (!err.empty() || startA != "take: the column description query result changed after Describe; the output columns no longer match it" ||
+            !startB.empty())
+        {
+            printf("FAIL changed layout: %s / %s / %s\n", err.c_str(), startA.c_str(), startB.c_str());
+            failed++;
+        }
+
+        // A key column that changed type family is found once the PIVOTCOL type is known
+        Case c("changed key type", pivot, pivotInput(vdb_udf::TypeInt)), d("changed key type other", pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(c).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" } });
+        pivotCase(d).columnList(listSchema(vdb_udf::TypeInt), { { "20", "a" } });
+        err = command(c, vdb_udf::Describe);
+        err += command(d, vdb_udf::Describe);
+        c.columnList(listSchema(vdb_udf::TypeVarChar), { { "10", "a" } });
+        err += command(c, vdb_udf::Start);
+        err += command(d, vdb_udf::Start);
+        std::string create = command(c, vdb_udf::Create);
+        if (!err.empty() || create != "PivotClass: the column description query result changed after Describe; key column 0 no longer matches the type of 'pivotcol' column 0")
+        {
+            printf("FAIL changed key type: %s / %s\n", err.c_str(), create.c_str());
+            failed++;
+        }
+    }
+
+    {
+        // A full versioned cache evicts the result used least recently, not the one with the smallest key
+        std::vector<int> runs;
+        for (int v = 0; v <= 17; v++)
+        {
+            // "cache 0" is used again before "cache 16" needs room
+            std::string version = "cache " + std::to_string(v == 16 ? 0 : (v == 17 ? 16 : v));
+            Case c("versioned cache", pivot, pivotInput(vdb_udf::TypeInt));
+            pivotCase(c).param("column_list_version", version.c_str()).columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" } });
+            c.output();
+            runs.push_back(c.m_arg.m_query_runs);
+        }
+        Case first("versioned cache first", pivot, pivotInput(vdb_udf::TypeInt)), second("versioned cache second", pivot, pivotInput(vdb_udf::TypeInt));
+        pivotCase(first).param("column_list_version", "cache 0").columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" } });
+        pivotCase(second).param("column_list_version", "cache 1").columnList(listSchema(vdb_udf::TypeInt), { { "10", "a" } });
+        first.output();
+        second.output();
+        if (runs[16] != 0 || runs[17] != 1 || first.m_arg.m_query_runs != 0 || second.m_arg.m_query_runs != 1)
+        {
+            printf("FAIL versioned cache: %d %d %d %d query runs\n", runs[16], runs[17], first.m_arg.m_query_runs, second.m_arg.m_query_runs);
+            failed++;
+        }
+    }
+
+    failed += checkMerge();
+    failed += checkSession();
+    failed += checkSharing();
+
+    printf("%s\n", failed ? "check FAILED" : "check passed");
+    return failed;
+}
+
+static void bench(int groups, int keys)
+{
+    const char *modes[] = { "hash", "dense", "perfect", "sorted" };
+    const vdb_udf::int_t types[] = { vdb_udf::TypeInt, vdb_udf::TypeVarChar };
+
+    printf("%-8s %-8s %10s %12s %10s %12s\n", "key", "lookup", "rows", "rows/sec", "ns/row", "allocs/row");
+    for (std::size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++)
+    {
+        for (std::size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+        {
+            std::vector<vdb_udf::Column> schema = listSchema(types[t]);
+            std::vector<vdb_udf::Column> in = pivotInput(types[t]);
+            std::vector<std::vector<std::string> > list;
+            for (int k = 0; k < keys; k++)
+                list.push_back({ std::to_string(1000 + 7 * k), "c" + std::to_string(k) });
+
+            Case c(modes[m], pivot, in);
+            pivotCase(c).param("lookup", modes[m]).columnList(schema, list);
+            c.m_arg.getRowStore().setKeep(false);
+            c.m_rows.reserve((std::size_t) groups * keys);
+            for (int g = 0; g < groups; g++)
+                for (int k = 0; k < keys; k++)
+                    c.m_rows.push_back(row(in, { std::to_string(g), list[(k * 5 + g) % keys][0], std::to_string(k) }));
+
+            UdfHostStats stats = runTable(pivot, c.m_arg, c.m_rows);
+            printf("%-8s %-8s %10llu %12.0f %10.1f %12.3f\n", types[t] == vdb_udf::TypeInt ? "int" : "varchar",
+                   modes[m], (unsigned long long) stats.m_rows, stats.m_rows / stats.m_seconds,
+                   stats.m_seconds * 1e9 / stats.m_rows, (double) stats.m_allocations / stats.m_rows);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && std::string(argv[1]) == "check")
+        return check() ? 1 : 0;
+    if (check())
+        return 1;
+    bench(argc > 1 ? atoi(argv[1]) : 20000, argc > 2 ? atoi(argv[2]) : 64);
+    return 0;
+}
@@ -0,0 +1,241 @@
+/// \file scalar_bench.cpp
+/// \brief Checks and measures the last-day.cpp scalar functions against the local SDK stand-in
+///
+/// scalar_bench check compares last_day and last_daytstamp with a day by day walk of the calendar, the block entry
+/// points with the per-row functions, and normalize_time with a 128-bit reference.  scalar_bench [rows] then reports
+/// ns/row for the per-row functions and their block forms.  Each function is called across the object boundary as
+/// the server calls it.
+
+#include <stdint.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "padb_udf.hpp"
+#include "calendar.hpp"
+
+extern "C"
+{
+    padb_udf::date_t last_day(padb_udf::ScalarArg &aux, padb_udf::date_t in_date);
+    padb_udf::date_t last_daytstamp(padb_udf::ScalarArg &aux, padb_udf::timestamp_t in_ts);
+    padb_udf::timestamp_t normalize_time(padb_udf::ScalarArg &aux, padb_udf::timestamp_t in_ts, padb_udf::timestamp_t base_ts, padb_udf::int_t interval_spec);
+    padb_udf::varchar_t *format_duration(padb_udf::ScalarArg &aux, padb_udf::int_t nsecs);
+    void last_day_block(const padb_udf::date_t *in_dates, const unsigned char *nulls, padb_udf::int_t count, padb_udf::date_t *out_dates);
+    void last_daytstamp_block(const padb_udf::timestamp_t *in_ts, const unsigned char *nulls, padb_udf::int_t count, padb_udf::date_t *out_dates);
+    void normalize_time_block(padb_udf::ScalarArg &aux, const padb_udf::timestamp_t *in_ts, const unsigned char *nulls, padb_udf::timestamp_t base_ts,
+        padb_udf::int_t interval_spec, padb_udf::int_t count, padb_udf::timestamp_t *out_ts);
+}
+
+#define USECS_PER_DAY 86400000000LL
+
+static long long failures = 0;
+
+static void fail(const char *what, long long in, long long got, long long want)
+{
+    if (failures++ < 10)
+        printf("FAIL %s(%lld) = %lld, expected %lld\n", what, in, got, want);
+}
+
+/* normalize_time by 128-bit division */
+static long long normalizeReference(long long in_ts, long long base_ts, int interval_spec)
+{
+    __int128 interval = (__int128) (interval_spec < 0 ? -(long long) interval_spec : interval_spec) * 1000000;
+    __int128 diff = (__int128) in_ts - base_ts;
+    return (long long) (base_ts + diff / interval * interval);
+}
+
+static std::string errorOf(void (*call)(padb_udf::ScalarArg &), padb_udf::ScalarArg &aux)
+{
+    try
+    {
+        call(aux);
+    }
+    catch (std::exception &e)
+    {
+        return e.what();
+    }
+    return "";
+}
+
+static void normalizeZero(padb_udf::ScalarArg &aux) { normalize_time(aux, 5000000, 0, 0); }
+static void normalizeBackwards(padb_udf::ScalarArg &aux) { normalize_time(aux, 0, 5000000, 60); }
+
+static int check()
+{
+    padb_udf::ScalarArg aux;
+    static const int monthDays[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    /* A zero interval is an error even as the first call */
+    if (errorOf(normalizeZero, aux) != "normalize_timestamp: Interval cannot be zero")
+        fail("normalize_time zero interval", 0, 0, 0);
+    if (errorOf(normalizeBackwards, aux) != "normalize_timestamp: Base timestamp cannot be greater than input timestamp")
+        fail("normalize_time base after input", 0, 0, 0);
+
+    /* Every date from 1600 to 2499, inside and outside the month end table */
+    long long day = calendar::days_from_civil(1600, 1, 1) - calendar::epoch_2000;
+    for (int year = 1600; year < 2500; year++)
+    {
+        for (int month = 1; month <= 12; month++)
+        {
+            int len = monthDays[month - 1] + (month == 2 && calendar::is_leap(year));
+            long long end = day + len - 1;
+            for (; day <= end; day++)
+            {
+                long long got = last_day(aux, (padb_udf::date_t) day);
+                if (got != end)
+                    fail("last_day", day, got, end);
+                got = last_daytstamp(aux, day * USECS_PER_DAY);
+                if (got != end)
+                    fail("last_daytstamp", day * USECS_PER_DAY, got, end);
+                got = last_daytstamp(aux, day * USECS_PER_DAY + USECS_PER_DAY - 1);
+                if (got != end)
+                    fail("last_daytstamp", day * USECS_PER_DAY + USECS_PER_DAY - 1, got, end);
+            }
+        }
+    }
+
+    aux.setNulls(1);
+    last_day(aux, 0);
+    if (!aux.returnedNull())
+        fail("last_day NULL", 0, 0, 0);
+    normalize_time(aux, 0, 0, 60);
+    if (!aux.returnedNull())
+        fail("normalize_time NULL", 0, 0, 0);
+    aux.setNulls(0);
+
+    /* Block forms against the per-row ones, with every third row NULL */
+    const int count = 1 << 20;
+    std::vector<padb_udf::date_t> dates(count), out(count);
+    std::vector<padb_udf::timestamp_t> stamps(count), outStamps(count);
+    std::vector<unsigned char> nulls((count + 7) / 8);
+    std::mt19937_64 rng(42);
+    for (int i = 0; i < count; i++)
+    {
+        dates[i] = (padb_udf::date_t) ((long long) (rng() % 2000000) - 1000000);
+        stamps[i] = (long long) (rng() % 4000000000000000000ULL) - 2000000000000000000LL;
+        if (i % 3 == 0)
+            nulls[i >> 3] |= 1 << (i & 7);
+    }
+    last_day_block(&dates[0], &nulls[0], count, &out[0]);
+    for (int i = 0; i < count; i++)
+    {
+        long long want = (i % 3 == 0) ? 0 : last_day(aux, dates[i]);
+        if (out[i] != want)
+            fail("last_day_block", dates[i], out[i], want);
+    }
+    last_daytstamp_block(&stamps[0], NULL, count, &out[0]);
+    for (int i = 0; i < count; i++)
+    {
+        long long want = last_daytstamp(aux, stamps[i]);
+        if (out[i] != want)
+            fail("last_daytstamp_block", stamps[i], out[i], want);
+    }
+
+    /* normalize_time over spans that overflowed the old 32-bit multiple */
+    const int intervals[] = { 1, 7, 60, 3600, 86400, 2147483647, -60 };
+    for (int i = 0; i < count; i++)
+    {
+        int interval = intervals[i % 7];
+        long long a = (long long) rng(), b = (long long) rng();
+        long long in_ts = a > b ? a : b, base_ts = a > b ? b : a;
+        long long got = normalize_time(aux, in_ts, base_ts, interval);
+        long long want = normalizeReference(in_ts, base_ts, interval);
+        if (got != want)
+            fail("normalize_time", in_ts, got, want);
+    }
+    for (int i = 0; i < count; i++)
+        stamps[i] = (long long) (rng() % 1000000000000000ULL);
+    normalize_time_block(aux, &stamps[0], &nulls[0], 0, 300, count, &outStamps[0]);
+    for (int i = 0; i < count; i++)
+    {
+        long long want = (i % 3 == 0) ? 0 : normalizeReference(stamps[i], 0, 300);
+        if (outStamps[i] != want)
+            fail("normalize_time_block", stamps[i], outStamps[i], want);
+    }
+
+    padb_udf::varchar_t *text = format_duration(aux, 3661);
+    if (std::string(text->str, text->len) != "01:01:01")
+        fail("format_duration", 3661, 0, 0);
+
+    printf("%s\n", failures ? "check FAILED" : "check passed");
+    return failures != 0;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double nsPerRow(Clock::time_point start, int rows)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count() * 1e9 / rows;
+}
+
+static void bench(int rows)
+{
+    padb_udf::ScalarArg aux;
+    std::vector<padb_udf::date_t> inTable(rows), outside(rows), out(rows);
+    std::vector<padb_udf::timestamp_t> stamps(rows), outStamps(rows);
+    std::mt19937_64 rng(7);
+    long long first = calendar::days_from_civil(1900, 1, 1) - calendar::epoch_2000;
+    long long span = calendar::days_from_civil(2101, 1, 1) - calendar::days_from_civil(1900, 1, 1);
+    long long sum = 0;
+
+    for (int i = 0; i < rows; i++)
+    {
+        inTable[i] = (padb_udf::date_t) (first + (long long) (rng() % span));
+        outside[i] = (padb_udf::date_t) (first + span + (long long) (rng() % 1000000));
+        stamps[i] = (long long) (rng() % 4000000000000000ULL) - 2000000000000000LL;
+    }
+
+    printf("month end table: %lld bytes for 1900-2100\n", span + 3);
+    printf("%-36s %10s\n", "function", "ns/row");
+
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < rows; i++)
+        sum += last_day(aux, inTable[i]);
+    printf("%-36s %10.2f\n", "last_day, 1900-2100", nsPerRow(start, rows));
+    start = Clock::now();
+    for (int i = 0; i < rows; i++)
+        sum += last_day(aux, outside[i]);
+    printf("%-36s %10.2f\n", "last_day, after 2100", nsPerRow(start, rows));
+    start = Clock::now();
+    last_day_block(&inTable[0], NULL, rows, &out[0]);
+    sum += out[rows - 1];
+    printf("%-36s %10.2f\n", "last_day_block, 1900-2100", nsPerRow(start, rows));
+    start = Clock::now();
+    last_day_block(&outside[0], NULL, rows, &out[0]);
+    sum += out[rows - 1];
+    printf("%-36s %10.2f\n", "last_day_block, after 2100", nsPerRow(start, rows));
+    start = Clock::now();
+    for (int i = 0; i < rows; i++)
+        sum += last_daytstamp(aux, stamps[i]);
+    printf("%-36s %10.2f\n", "last_daytstamp", nsPerRow(start, rows));
+    start = Clock::now();
+    last_daytstamp_block(&stamps[0], NULL, rows, &out[0]);
+    sum += out[rows - 1];
+    printf("%-36s %10.2f\n", "last_daytstamp_block", nsPerRow(start, rows));
+
+    start = Clock::now();
+    for (int i = 0; i < rows; i++)
+        sum += normalize_time(aux, stamps[i], -2000000000000000LL, 300);
+    printf("%-36s %10.2f\n", "normalize_time", nsPerRow(start, rows));
+    start = Clock::now();
+    normalize_time_block(aux, &stamps[0], NULL, -2000000000000000LL, 300, rows, &outStamps[0]);
+    sum += outStamps[rows - 1];
+    printf("%-36s %10.2f\n", "normalize_time_block", nsPerRow(start, rows));
+
+    /* Keeps the loops from being optimized away */
+    if (sum == 42)
+        printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && std::string(argv[1]) == "check")
+        return check();
+    if (check())
+        return 1;
+    bench(argc > 1 ? atoi(argv[1]) : 10000000);
+    return 0;
+}
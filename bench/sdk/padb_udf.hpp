@@ -0,0 +1,88 @@
+/// \file padb_udf.hpp
+/// \brief Local stand-in for the scalar function SDK header, for building and measuring last-day.cpp outside the
+/// database
+///
+/// Dates count days and timestamps microseconds from 2000-01-01, as in the server.  A NULL return is marked on the
+/// ScalarArg rather than in the returned value.
+
+#ifndef PADB_UDF_HPP
+#define PADB_UDF_HPP
+
+#include <stdint.h>
+#include <stdexcept>
+#include <string>
+
+namespace padb_udf
+{
+    typedef int32_t int_t;
+    typedef int32_t date_t;
+    typedef int64_t timestamp_t;
+    typedef int64_t num_microsec_t;
+    typedef int32_t len_t;
+    typedef int32_t year_t;
+    typedef int32_t month_t;
+    typedef int32_t day_of_month_t;
+
+    struct varchar_t
+    {
+        len_t len;
+        char str[1];
+    };
+
+    class ScalarArg
+    {
+    public:
+        ScalarArg() : m_nulls(0), m_ret_null(false), m_buf(NULL), m_buf_len(0)
+        {
+        }
+
+        ~ScalarArg()
+        {
+            ::operator delete(m_buf);
+        }
+
+        bool isNull(int arg) { return (m_nulls >> arg) & 1; }
+
+        date_t retDateNull() { m_ret_null = true; return 0; }
+        date_t retDateVal(date_t x) { m_ret_null = false; return x; }
+        timestamp_t retTimeStampNull() { m_ret_null = true; return 0; }
+        timestamp_t retTimeStampVal(timestamp_t x) { m_ret_null = false; return x; }
+        varchar_t *retVarCharNull() { m_ret_null = true; return NULL; }
+        varchar_t *retVarCharVal(varchar_t *x) { m_ret_null = false; return x; }
+
+        varchar_t *getRetVarCharBuf(len_t *maxlen)
+        {
+            if (*maxlen > m_buf_len)
+            {
+                ::operator delete(m_buf);
+                m_buf = (varchar_t *) ::operator new(sizeof(varchar_t) + *maxlen);
+                m_buf_len = *maxlen;
+            }
+            return m_buf;
+        }
+
+        void throwError(const char *where, const char *msg)
+        {
+            throw std::runtime_error(std::string(where) + ": " + msg);
+        }
+
+        // Host side: bit i of nulls marks argument i NULL
+        void setNulls(unsigned nulls) { m_nulls = nulls; }
+        bool returnedNull() const { return m_ret_null; }
+
+    private:
+        unsigned m_nulls;
+        bool m_ret_null;
+        varchar_t *m_buf;
+        len_t m_buf_len;
+    };
+
+    inline num_microsec_t microsecondsBetween(timestamp_t a, timestamp_t b)
+    {
+        return a - b;
+    }
+}
+
+#define PADB_UDF_VERSION(name)
+
+#endif
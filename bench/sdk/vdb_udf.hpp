@@ -0,0 +1,457 @@
+/// \file vdb_udf.hpp
+/// \brief Local stand-in for the table function SDK header, for building and measuring pivot.cpp outside the database
+///
+/// Only the part of the SDK interface that pivot.cpp uses is here, with the same names and signatures.  Rows hold
+/// typed values in a vector instead of the server's tuple format, so absolute timings are not those of the server;
+/// the stand-in is for comparing one version of the functions against another.  The methods after "Host side" are
+/// not in the real SDK: udf_host.hpp uses them to play the part of the server.  getInputColumn and getOutputColumn
+/// return NULL past the last column, as the SDK's do.
+
+#ifndef VDB_UDF_HPP
+#define VDB_UDF_HPP
+
+#include <stdint.h>
+#include <cstring>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace vdb_udf
+{
+    typedef int32_t int_t;
+    typedef int16_t smallint_t;
+    typedef int64_t bigint_t;
+    typedef __int128 numeric_t;
+    typedef float float4_t;
+    typedef double float8_t;
+    typedef int32_t date_t;
+    typedef int64_t timestamp_t;
+    typedef bool bool_t;
+    typedef int_t ColumnIndex;
+    typedef std::vector<ColumnIndex> ColumnIndexVector;
+
+    enum
+    {
+        TypeTimeStamp = 1,
+        TypeBigInt,
+        TypeNumeric,
+        TypeInt,
+        TypeDate,
+        TypeSmallInt,
+        TypeFloat4,
+        TypeFloat8,
+        TypeVarChar,
+        TypeBpChar,
+        TypeBoolean
+    };
+
+    enum Command
+    {
+        Describe,
+        Create,
+        Finalize,
+        Destroy,
+        Start,
+        Shutdown,
+        Abort
+    };
+
+    enum
+    {
+        npColRef,
+        npConst
+    };
+
+    struct Column
+    {
+        int_t type;
+        int_t length;
+        bool_t nullable;
+        int_t precision;
+        int_t scale;
+        std::string name;
+    };
+
+    typedef std::vector<Column *> Schema;
+
+    /// One column value.  Integer, date, timestamp, numeric and boolean values are kept in m_int, floats in
+    /// m_float and strings in m_str; m_type is the type the value was set with.
+    struct Value
+    {
+        bool_t m_null;
+        int_t m_type;
+        numeric_t m_int;
+        float8_t m_float;
+        std::string m_str;
+
+        Value() : m_null(true), m_type(0), m_int(0), m_float(0)
+        {
+        }
+    };
+
+    class RowDesc
+    {
+    public:
+        bool_t isNull(ColumnIndex col) { return at(col).m_null; }
+        void setNull(ColumnIndex col, bool_t null) { at(col).m_null = null; }
+
+        timestamp_t getTimeStamp(ColumnIndex col) { return (timestamp_t) at(col).m_int; }
+        bigint_t getBigInt(ColumnIndex col) { return (bigint_t) at(col).m_int; }
+        numeric_t getNumeric(ColumnIndex col) { return at(col).m_int; }
+        int_t getInt(ColumnIndex col) { return (int_t) at(col).m_int; }
+        date_t getDate(ColumnIndex col) { return (date_t) at(col).m_int; }
+        smallint_t getSmallInt(ColumnIndex col) { return (smallint_t) at(col).m_int; }
+        bool_t getBoolean(ColumnIndex col) { return at(col).m_int != 0; }
+        float4_t getFloat4(ColumnIndex col) { return (float4_t) at(col).m_float; }
+        float8_t getFloat8(ColumnIndex col) { return at(col).m_float; }
+
+        const char *getVarChar(ColumnIndex col, int_t *len)
+        {
+            *len = (int_t) at(col).m_str.size();
+            return at(col).m_str.data();
+        }
+
+        const char *getBpChar(ColumnIndex col, int_t *len)
+        {
+            return getVarChar(col, len);
+        }
+
+        /// Text of the value: decimal for integers (numerics unscaled), %.17g for floats
+        void getValueAsString(ColumnIndex col, std::string &out)
+        {
+            const Value &v = at(col);
+            char buf[64];
+
+            if (v.m_null || v.m_type == TypeVarChar || v.m_type == TypeBpChar)
+            {
+                out = v.m_str;
+                return;
+            }
+            if (v.m_type == TypeFloat4 || v.m_type == TypeFloat8)
+            {
+                snprintf(buf, sizeof(buf), "%.17g", v.m_float);
+                out = buf;
+                return;
+            }
+            formatInt(v.m_int, out);
+        }
+
+        void setTimeStamp(ColumnIndex col, timestamp_t x) { setInt(col, TypeTimeStamp, x); }
+        void setBigInt(ColumnIndex col, bigint_t x) { setInt(col, TypeBigInt, x); }
+        void setNumeric(ColumnIndex col, numeric_t x) { setInt(col, TypeNumeric, x); }
+        void setInt(ColumnIndex col, int_t x) { setInt(col, TypeInt, x); }
+        void setDate(ColumnIndex col, date_t x) { setInt(col, TypeDate, x); }
+        void setSmallInt(ColumnIndex col, smallint_t x) { setInt(col, TypeSmallInt, x); }
+        void setBoolean(ColumnIndex col, bool_t x) { setInt(col, TypeBoolean, x); }
+        void setFloat4(ColumnIndex col, float4_t x) { setFloat(col, TypeFloat4, x); }
+        void setFloat8(ColumnIndex col, float8_t x) { setFloat(col, TypeFloat8, x); }
+        void setVarChar(ColumnIndex col, const char *p, int_t len) { setString(col, TypeVarChar, p, len); }
+        void setBpChar(ColumnIndex col, const char *p, int_t len) { setString(col, TypeBpChar, p, len); }
+
+        // Host side
+        Value &at(ColumnIndex col)
+        {
+            if ((std::size_t) col >= m_values.size())
+                m_values.resize(col + 1);
+            return m_values[col];
+        }
+
+        std::size_t size() const { return m_values.size(); }
+
+        /// The value of a column, or NULL if it was never set
+        const Value *find(ColumnIndex col) const
+        {
+            return ((std::size_t) col < m_values.size()) ? &m_values[col] : NULL;
+        }
+
+        static void formatInt(numeric_t x, std::string &out)
+        {
+            char buf[48];
+            int pos = sizeof(buf);
+            unsigned __int128 mag = (x < 0) ? -(unsigned __int128) x : (unsigned __int128) x;
+
+            buf[--pos] = '\0';
+            do
+            {
+                buf[--pos] = '0' + (int) (mag % 10);
+                mag /= 10;
+            } while (mag != 0);
+            if (x < 0)
+                buf[--pos] = '-';
+            out = buf + pos;
+        }
+
+    private:
+        std::vector<Value> m_values;
+
+        void setInt(ColumnIndex col, int_t type, numeric_t x)
+        {
+            Value &v = at(col);
+            v.m_null = false;
+            v.m_type = type;
+            v.m_int = x;
+        }
+
+        void setFloat(ColumnIndex col, int_t type, float8_t x)
+        {
+            Value &v = at(col);
+            v.m_null = false;
+            v.m_type = type;
+            v.m_float = x;
+        }
+
+        void setString(ColumnIndex col, int_t type, const char *p, int_t len)
+        {
+            Value &v = at(col);
+            v.m_null = false;
+            v.m_type = type;
+            v.m_str.assign(p, len);
+        }
+    };
+
+    /// Output rows.  The host keeps every row put, or with setKeep(false) only counts them and keeps the last one.
+    class RowStore
+    {
+    public:
+        RowStore() : m_keep(true), m_count(0)
+        {
+        }
+
+        RowDesc *alloc() { return new RowDesc(); }
+        void free(RowDesc *row) { delete row; }
+
+        void put(RowDesc *row)
+        {
+            m_count++;
+            if (m_keep)
+                m_rows.push_back(*row);
+            else
+                m_last = *row;
+        }
+
+        // Host side
+        void setKeep(bool_t keep) { m_keep = keep; }
+        std::vector<RowDesc> &rows() { return m_rows; }
+        uint64_t count() const { return m_count; }
+
+    private:
+        bool_t m_keep;
+        uint64_t m_count;
+        std::vector<RowDesc> m_rows;
+        RowDesc m_last;
+    };
+
+    class Serializer
+    {
+    public:
+        Serializer() : m_pos(0)
+        {
+        }
+
+        Serializer &operator<<(int_t x)
+        {
+            m_buf.append((const char *) &x, sizeof(x));
+            return *this;
+        }
+
+        Serializer &operator>>(int_t &x)
+        {
+            check(sizeof(x));
+            memcpy(&x, m_buf.data() + m_pos, sizeof(x));
+            m_pos += sizeof(x);
+            return *this;
+        }
+
+        Serializer &operator<<(const std::string &x)
+        {
+            *this << (int_t) x.size();
+            m_buf.append(x);
+            return *this;
+        }
+
+        Serializer &operator>>(std::string &x)
+        {
+            int_t len;
+            *this >> len;
+            check(len);
+            x.assign(m_buf.data() + m_pos, len);
+            m_pos += len;
+            return *this;
+        }
+
+        // Host side
+        std::string &buffer() { return m_buf; }
+
+    private:
+        std::string m_buf;
+        std::size_t m_pos;
+
+        void check(std::size_t n)
+        {
+            if (m_pos + n > m_buf.size())
+                throw std::runtime_error("session data read past its end");
+        }
+    };
+
+    class SessionObject
+    {
+    public:
+        virtual ~SessionObject() {}
+        virtual void serialize(Serializer &s) = 0;
+        virtual void deserialize(Serializer &s) = 0;
+    };
+
+    class NamedParameterValue
+    {
+    public:
+        int_t kindOfParameter() const { return m_kind; }
+        ColumnIndex getColRef() const { return m_cols.empty() ? 0 : m_cols[0]; }
+        void fillColumnIndexVector(ColumnIndexVector &cols) const { cols = m_cols; }
+        void getValueAsString(std::string &out) const { out = m_text; }
+
+        // Host side
+        int_t m_kind;
+        ColumnIndexVector m_cols;
+        std::string m_text;
+    };
+
+    class TableArg;
+
+    class TableFunction
+    {
+    public:
+        virtual ~TableFunction() {}
+        virtual void process(TableArg &arg, RowDesc *row) = 0;
+    };
+
+    class TableArg
+    {
+    public:
+        TableArg() : m_query_runs(0), m_command(Describe), m_global(false), m_functor(NULL)
+        {
+        }
+
+        ~TableArg()
+        {
+            delete m_functor;
+        }
+
+        Command getCommand() { return m_command; }
+
+        const NamedParameterValue *getNamedParameterValue(const char *name)
+        {
+            std::map<std::string, NamedParameterValue>::const_iterator it = m_params.find(name);
+            return (it == m_params.end()) ? NULL : &it->second;
+        }
+
+        // NULL past the last column
+        Column *getInputColumn(ColumnIndex col) { return (col >= 0 && (std::size_t) col < m_in_cols.size()) ? &m_in_cols[col] : NULL; }
+        Column *getOutputColumn(ColumnIndex col) { return (col >= 0 && (std::size_t) col < m_out_cols.size()) ? &m_out_cols[col] : NULL; }
+
+        ColumnIndex addOutputColumn(int_t type, int_t length, bool_t nullable, int_t precision, int_t scale)
+        {
+            Column c = { type, length, nullable, precision, scale, "" };
+            m_out_cols.push_back(c);
+            return (ColumnIndex) m_out_cols.size() - 1;
+        }
+
+        void copyColumnSchema(ColumnIndex col) { m_out_cols.push_back(m_in_cols.at(col)); }
+        void addPartitionByColumn(ColumnIndex col) { m_partition_by.push_back(col); }
+        void addOrderByColumn(ColumnIndex col) { m_order_by.push_back(col); }
+        void setGlobalPartitioning(bool_t global) { m_global = global; }
+        void enableSessionCommands() {}
+        RowStore &getRowStore() { return m_store; }
+
+        void copyColumnValue(RowDesc *in, ColumnIndex inCol, RowDesc *out, ColumnIndex outCol)
+        {
+            out->at(outCol) = in->at(inCol);
+        }
+
+        void throwError(const char *where, const char *msg)
+        {
+            throw std::runtime_error(std::string(where) + ": " + msg);
+        }
+
+        void setSessionData(SessionObject &obj)
+        {
+            Serializer s;
+            obj.serialize(s);
+            m_session = s.buffer();
+        }
+
+        void getSessionData(SessionObject &obj)
+        {
+            Serializer s;
+            s.buffer() = m_session;
+            obj.deserialize(s);
+        }
+
+        void assignFunctor(TableFunction *functor) { m_functor = functor; }
+        TableFunction *getFunctor() { return m_functor; }
+
+        void destroyFunctor()
+        {
+            delete m_functor;
+            m_functor = NULL;
+        }
+
+        // Host side
+        void setCommand(Command command) { m_command = command; }
+
+        void addInputColumn(int_t type, int_t length, const char *name, int_t precision = 0, int_t scale = 0)
+        {
+            Column c = { type, length, true, precision, scale, name };
+            m_in_cols.push_back(c);
+        }
+
+        void setColRef(const char *name, const ColumnIndexVector &cols)
+        {
+            NamedParameterValue &p = m_params[name];
+            p.m_kind = npColRef;
+            p.m_cols = cols;
+        }
+
+        void setConst(const char *name, const std::string &text)
+        {
+            NamedParameterValue &p = m_params[name];
+            p.m_kind = npConst;
+            p.m_text = text;
+        }
+
+        /// Result that every SQLClient query run through this argument returns
+        void setQueryResult(const std::vector<Column> &schema, const std::vector<RowDesc> &rows)
+        {
+            m_query_schema = schema;
+            m_query_rows = rows;
+        }
+
+        std::vector<Column> &outputColumns() { return m_out_cols; }
+        /// Session data as Start set it, for checks that damage it before Create
+        std::string &sessionData() { return m_session; }
+        const ColumnIndexVector &partitionBy() const { return m_partition_by; }
+        const ColumnIndexVector &orderBy() const { return m_order_by; }
+        bool_t globalPartitioning() const { return m_global; }
+
+        std::vector<Column> m_query_schema;
+        std::vector<RowDesc> m_query_rows;
+        int_t m_query_runs;
+
+    private:
+        Command m_command;
+        std::map<std::string, NamedParameterValue> m_params;
+        std::vector<Column> m_in_cols;
+        std::vector<Column> m_out_cols;
+        ColumnIndexVector m_partition_by;
+        ColumnIndexVector m_order_by;
+        bool_t m_global;
+        RowStore m_store;
+        std::string m_session;
+        TableFunction *m_functor;
+    };
+}
+
+#define vdb_UDF_VERSION(name)
+
+#endif
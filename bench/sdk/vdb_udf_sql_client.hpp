@@ -0,0 +1,44 @@
+/// \file vdb_udf_sql_client.hpp
+/// \brief Local stand-in for the SDK's SQL client: every query returns the result set on the TableArg
+
+#ifndef VDB_UDF_SQL_CLIENT_HPP
+#define VDB_UDF_SQL_CLIENT_HPP
+
+#include "vdb_udf.hpp"
+
+namespace vdb_udf
+{
+    class SQLClient
+    {
+    public:
+        explicit SQLClient(TableArg &arg) : m_arg(arg), m_pos(0)
+        {
+        }
+
+        Schema &open(const char * /*query*/)
+        {
+            m_arg.m_query_runs++;
+            m_schema.clear();
+            for (std::size_t i = 0; i < m_arg.m_query_schema.size(); i++)
+                m_schema.push_back(&m_arg.m_query_schema[i]);
+            m_pos = 0;
+            return m_schema;
+        }
+
+        RowDesc *fetch()
+        {
+            return (m_pos < m_arg.m_query_rows.size()) ? &m_arg.m_query_rows[m_pos++] : NULL;
+        }
+
+        void close()
+        {
+        }
+
+    private:
+        TableArg &m_arg;
+        Schema m_schema;
+        std::size_t m_pos;
+    };
+}
+
+#endif
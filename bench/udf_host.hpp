@@ -0,0 +1,127 @@
+/// \file udf_host.hpp
+/// \brief Plays the server's part for a table function against the local SDK stand-in
+///
+/// runTable drives the command sequence of one statement on one slice: Describe, Start, then for every partition
+/// Create, process() per row, Finalize and Destroy, and finally Shutdown.  The input is sorted by the PARTITION BY
+/// and ORDER BY columns the function registered in Describe and split into partitions on the PARTITION BY columns,
+/// as the server would.  Session data set in Start is what Create reads back.
+
+#ifndef UDF_HOST_HPP
+#define UDF_HOST_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "vdb_udf.hpp"
+
+/// Heap allocations made by the process so far; counted by the operator new of the host program
+extern uint64_t udfHostAllocations;
+
+/// Time and allocations spent in the Create ... Destroy commands and process() calls of a run
+struct UdfHostStats
+{
+    double m_seconds;
+    uint64_t m_allocations;
+    uint64_t m_rows;
+    uint64_t m_partitions;
+};
+
+/// Order of two column values; NULL, or a column never set, sorts last
+static inline int udfHostCompare(const vdb_udf::Value *a, const vdb_udf::Value *b)
+{
+    bool aNull = (a == NULL || a->m_null), bNull = (b == NULL || b->m_null);
+
+    if (aNull || bNull)
+        return (aNull == bNull) ? 0 : (aNull ? 1 : -1);
+    if (a->m_int != b->m_int)
+        return (a->m_int < b->m_int) ? -1 : 1;
+    if (a->m_float != b->m_float)
+        return (a->m_float < b->m_float) ? -1 : 1;
+    return a->m_str.compare(b->m_str);
+}
+
+struct UdfHostLess
+{
+    const vdb_udf::ColumnIndexVector &m_cols;
+
+    bool operator()(const vdb_udf::RowDesc &a, const vdb_udf::RowDesc &b) const
+    {
+        for (std::size_t i = 0; i < m_cols.size(); i++)
+        {
+            int c = udfHostCompare(a.find(m_cols[i]), b.find(m_cols[i]));
+            if (c != 0)
+                return c < 0;
+        }
+        return false;
+    }
+};
+
+/// Run the table function udf over input.  The output rows are left in the argument's RowStore.
+static inline UdfHostStats runTable(void (*udf)(vdb_udf::TableArg &), vdb_udf::TableArg &arg,
+                                    std::vector<vdb_udf::RowDesc> &input)
+{
+    UdfHostStats stats = { 0, 0, 0, 0 };
+    vdb_udf::ColumnIndexVector sortCols;
+
+    arg.setCommand(vdb_udf::Describe);
+    udf(arg);
+    arg.setCommand(vdb_udf::Start);
+    udf(arg);
+
+    sortCols = arg.partitionBy();
+    sortCols.insert(sortCols.end(), arg.orderBy().begin(), arg.orderBy().end());
+    UdfHostLess less = { sortCols };
+    std::stable_sort(input.begin(), input.end(), less);
+    UdfHostLess samePartition = { arg.partitionBy() };
+
+    uint64_t allocations = udfHostAllocations;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::size_t row = 0;
+    do
+    {
+        arg.setCommand(vdb_udf::Create);
+        udf(arg);
+        vdb_udf::TableFunction *functor = arg.getFunctor();
+        std::size_t first = row;
+        for (; row < input.size() && (row == first || !samePartition(input[first], input[row])); row++)
+            functor->process(arg, &input[row]);
+        arg.setCommand(vdb_udf::Finalize);
+        udf(arg);
+        arg.setCommand(vdb_udf::Destroy);
+        udf(arg);
+        stats.m_partitions++;
+    } while (row < input.size());
+    stats.m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.m_allocations = udfHostAllocations - allocations;
+    stats.m_rows = input.size();
+
+    arg.setCommand(vdb_udf::Shutdown);
+    udf(arg);
+    return stats;
+}
+
+/// Text of an output row, tab separated, with NULL for NULL values
+static inline std::string formatRow(vdb_udf::RowDesc &row, std::size_t columns)
+{
+    std::string out, value;
+
+    for (std::size_t col = 0; col < columns; col++)
+    {
+        if (col > 0)
+            out.push_back('\t');
+        if (row.isNull(col))
+        {
+            out.append("NULL");
+            continue;
+        }
+        row.getValueAsString(col, value);
+        out.append(value);
+    }
+    return out;
+}
+
+#endif
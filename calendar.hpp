@@ -0,0 +1,135 @@
+/// \file
+/// Proleptic Gregorian calendar arithmetic shared by the date UDFs.
+///
+/// Everything here is constexpr, header only and independent of the UDF SDKs.  Days are counted from 1970-01-01;
+/// a caller whose date type uses another epoch adds its offset on the way in and subtracts it on the way out.
+/// Internally years run from March, so that February, the only irregular month, is the last month of a year: month
+/// boundaries are then a fixed linear function of the month and only the year length depends on leap years.
+///
+/// The functions are written as single expressions so that they are constexpr under C++11 and reduce to a few
+/// multiplies once inlined into a loop.
+
+#ifndef CALENDAR_HPP
+#define CALENDAR_HPP
+
+namespace calendar
+{
+	/// Day number of 2000-01-01, the epoch of PostgreSQL style date and timestamp types
+	constexpr long long epoch_2000 = 10957;
+
+	/// A calendar date; month and day count from 1
+	struct civil_date
+	{
+		long long year;
+		int month;
+		int day;
+	};
+
+	/// a / b rounded toward negative infinity, for b > 0
+	constexpr long long floor_div(long long a, long long b)
+	{
+		return (a - (a < 0 ? b - 1 : 0)) / b;
+	}
+
+	constexpr bool is_leap(long long year)
+	{
+		return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+	}
+
+	constexpr int month_length(long long year, int month)
+	{
+		return month == 2 ? (is_leap(year) ? 29 : 28) : 30 + ((month + (month >> 3)) & 1);
+	}
+
+	namespace detail
+	{
+		// Days from 0000-03-01 to 1970-01-01
+		constexpr long long civil_epoch = 719468;
+
+		// A 400 year era, its day within the era, the March based year of that day within the era and the day
+		// of that year
+		constexpr long long era(long long z) { return floor_div(z, 146097); }
+		constexpr long long day_of_era(long long z) { return z - era(z) * 146097; }
+		constexpr long long year_of_era(long long doe) { return (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; }
+		constexpr long long day_of_year(long long doe) { return doe - (365 * year_of_era(doe) + year_of_era(doe) / 4 - year_of_era(doe) / 100); }
+		constexpr long long day_of_year_z(long long z) { return day_of_year(day_of_era(z)); }
+
+		// March based month 0..11 of a day of the year, and the day of the year its first day falls on
+		constexpr long long month_of_year(long long doy) { return (5 * doy + 2) / 153; }
+		constexpr long long month_first_day(long long mp) { return (153 * mp + 2) / 5; }
+
+		// Length of the March based year yoe of an era; its February is in the calendar year yoe + 1
+		constexpr long long year_length(long long yoe)
+		{
+			return 365 + ((yoe + 1) / 4 - yoe / 4) - ((yoe + 1) / 100 - yoe / 100) + (yoe + 1) / 400;
+		}
+
+		// The last day of March based month mp of year yoe as a day of that year.  February ends with the year.
+		constexpr long long month_last_day(long long mp, long long yoe)
+		{
+			return month_first_day(mp + 1) - 1 < year_length(yoe) - 1 ? month_first_day(mp + 1) - 1 : year_length(yoe) - 1;
+		}
+
+		constexpr int civil_month(long long mp) { return (int) (mp < 10 ? mp + 3 : mp - 9); }
+
+		constexpr civil_date civil_from_z(long long z)
+		{
+			return civil_date{ era(z) * 400 + year_of_era(day_of_era(z)) + (month_of_year(day_of_year_z(z)) >= 10),
+				civil_month(month_of_year(day_of_year_z(z))),
+				(int) (day_of_year_z(z) - month_first_day(month_of_year(day_of_year_z(z))) + 1) };
+		}
+
+		constexpr long long days_from_year(long long y, int month, int day)
+		{
+			return floor_div(y, 400) * 146097 + (y - floor_div(y, 400) * 400) * 365 + (y - floor_div(y, 400) * 400) / 4 -
+				(y - floor_div(y, 400) * 400) / 100 + month_first_day(month > 2 ? month - 3 : month + 9) + day - 1 - civil_epoch;
+		}
+	}
+
+	/// Day number of a date
+	constexpr long long days_from_civil(long long year, int month, int day)
+	{
+		return detail::days_from_year(year - (month <= 2), month, day);
+	}
+
+	/// Date of a day number
+	constexpr civil_date civil_from_days(long long days)
+	{
+		return detail::civil_from_z(days + detail::civil_epoch);
+	}
+
+	/// Day number of the first day of the month of a day number
+	constexpr long long month_start(long long days)
+	{
+		return days - detail::day_of_year_z(days + detail::civil_epoch) +
+			detail::month_first_day(detail::month_of_year(detail::day_of_year_z(days + detail::civil_epoch)));
+	}
+
+	/// Day number of the last day of the month of a day number
+	constexpr long long month_end(long long days)
+	{
+		return days - detail::day_of_year_z(days + detail::civil_epoch) +
+			detail::month_last_day(detail::month_of_year(detail::day_of_year_z(days + detail::civil_epoch)),
+				detail::year_of_era(detail::day_of_era(days + detail::civil_epoch)));
+	}
+
+	static_assert(days_from_civil(1970, 1, 1) == 0, "epoch");
+	static_assert(days_from_civil(2000, 1, 1) == epoch_2000, "2000-01-01");
+	static_assert(days_from_civil(1969, 12, 31) == -1, "day before the epoch");
+	static_assert(days_from_civil(1600, 3, 1) == -135080, "start of an era");
+	static_assert(civil_from_days(0).year == 1970 && civil_from_days(0).month == 1 && civil_from_days(0).day == 1, "epoch");
+	static_assert(civil_from_days(11016).year == 2000 && civil_from_days(11016).month == 2 && civil_from_days(11016).day == 29, "leap day");
+	static_assert(civil_from_days(-719528).year == 0 && civil_from_days(-719528).month == 1, "year 0");
+	static_assert(month_length(2000, 2) == 29 && month_length(1900, 2) == 28 && month_length(2024, 2) == 29, "february");
+	static_assert(month_length(2023, 1) == 31 && month_length(2023, 4) == 30 && month_length(2023, 7) == 31 &&
+		month_length(2023, 8) == 31 && month_length(2023, 11) == 30 && month_length(2023, 12) == 31, "month lengths");
+	static_assert(month_end(days_from_civil(2024, 2, 10)) == days_from_civil(2024, 2, 29), "leap february");
+	static_assert(month_end(days_from_civil(1900, 2, 1)) == days_from_civil(1900, 2, 28), "century february");
+	static_assert(month_end(days_from_civil(2000, 2, 29)) == days_from_civil(2000, 2, 29), "400 year february");
+	static_assert(month_end(days_from_civil(2023, 12, 31)) == days_from_civil(2023, 12, 31), "december");
+	static_assert(month_end(days_from_civil(-1, 1, 15)) == days_from_civil(-1, 1, 31), "negative years");
+	static_assert(month_start(days_from_civil(2024, 3, 31)) == days_from_civil(2024, 3, 1), "march");
+	static_assert(month_start(days_from_civil(2023, 1, 1)) == days_from_civil(2023, 1, 1), "january");
+}
+
+#endif
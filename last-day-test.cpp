@@ -1,10 +1,10 @@
 #include "padb_udf.hpp"
 #include <stdlib.h>
 #include <string.h>
-
-#define isleap(y) (((y) % 4) == 0 && (((y) % 100) != 0 || ((y) % 400) == 0))
+#include "calendar.hpp"
 
 #define MICROSECOND 	((padb_udf::num_microsec_t) 1000000)
+#define MICROSECONDS_PER_DAY	((padb_udf::num_microsec_t) 86400000000LL)
 PADB_UDF_VERSION(last_day)
 PADB_UDF_VERSION(last_daytstamp)
 PADB_UDF_VERSION(format_duration)
@@ -80,21 +80,11 @@ extern "C"
 		return aux.retVarCharVal( retval );
 
 	}
-//	padb_udf::date_t calc_lastdayofmonth(padb_udf::date_t in_date)
-//	{
-//		padb_udf::int_t m_last_days[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
-//		padb_udf::year_t  cyear = padb_udf::extract_year_from_date(in_date);
-//		padb_udf::month_t  cmon = padb_udf::extract_month_from_date(in_date);
-//		padb_udf::day_of_month_t  cday = padb_udf::extract_day_from_date(in_date);
-//		padb_udf::date_t retdate;
-//
-//		if (isleap(cyear) && cmon == 2)
-//			retdate = padb_udf::date_plus_days(in_date, (29 - cday));
-//		else
-//			retdate = padb_udf::date_plus_days(in_date, m_last_days[cmon-1]-cday);
-//
-//		return retdate;
-//	}
+	/* date_t counts days from 2000-01-01 */
+	padb_udf::date_t calc_lastdayofmonth(padb_udf::date_t in_date)
+	{
+		return (padb_udf::date_t) (calendar::month_end((long long) in_date + calendar::epoch_2000) - calendar::epoch_2000);
+	}
 		
 	padb_udf::date_t last_daytstamp(padb_udf::ScalarArg &aux, padb_udf::timestamp_t in_ts)
 	{
@@ -104,7 +94,7 @@ extern "C"
 		if (aux.isNull(0))
 			return aux.retDateNull();
 
-		cdate = padb_udf::extract_date_from_timestamp(in_ts);
+		cdate = (padb_udf::date_t) calendar::floor_div(in_ts, MICROSECONDS_PER_DAY);
 
 		retdate = calc_lastdayofmonth(cdate);
 		
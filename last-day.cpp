@@ -1,10 +1,150 @@
 #include "padb_udf.hpp"
 #include <stdlib.h>
 #include <string.h>
-
-#define isleap(y) (((y) % 4) == 0 && (((y) % 100) != 0 || ((y) % 400) == 0))
+#include "calendar.hpp"
 
 #define MICROSECOND 	((padb_udf::num_microsec_t) 1000000)
+#define MICROSECONDS_PER_DAY	((padb_udf::num_microsec_t) 86400000000LL)
+/* date_t counts days and timestamp_t microseconds from 2000-01-01 */
+#define DATE_EPOCH_DAYS	calendar::epoch_2000
+/* years covered by the month end table; dates outside them take the arithmetic path */
+#ifndef LAST_DAY_TABLE_FIRST_YEAR
+#define LAST_DAY_TABLE_FIRST_YEAR	1900
+#endif
+#ifndef LAST_DAY_TABLE_LAST_YEAR
+#define LAST_DAY_TABLE_LAST_YEAR	2100
+#endif
+#define LAST_DAY_TABLE_FIRST	(calendar::days_from_civil(LAST_DAY_TABLE_FIRST_YEAR, 1, 1) - DATE_EPOCH_DAYS)
+#define LAST_DAY_TABLE_DAYS	(calendar::days_from_civil(LAST_DAY_TABLE_LAST_YEAR + 1, 1, 1) - \
+	calendar::days_from_civil(LAST_DAY_TABLE_FIRST_YEAR, 1, 1))
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/* Month end of a date with arithmetic only: no SDK calls, tables or data dependent branches */
+static inline padb_udf::date_t block_month_end(padb_udf::date_t in_date)
+{
+	return (padb_udf::date_t) (calendar::month_end((long long) in_date + DATE_EPOCH_DAYS) - DATE_EPOCH_DAYS);
+}
+
+static_assert(LAST_DAY_TABLE_FIRST_YEAR <= LAST_DAY_TABLE_LAST_YEAR, "empty month end table");
+
+/*
+ * Days from each date of the table years to the end of its month, filled in when the library is loaded.  One
+ * byte a day keeps the default 1900 - 2100 range at about 72KB, small enough to stay resident in L2.  The three
+ * spare bytes let the block form gather a 32-bit word at the last entry.
+ */
+static struct month_end_table
+{
+	unsigned char delta[LAST_DAY_TABLE_DAYS + 3];
+
+	month_end_table()
+	{
+		long long i = 0;
+
+		for (long long year = LAST_DAY_TABLE_FIRST_YEAR; year <= LAST_DAY_TABLE_LAST_YEAR; year++)
+			for (int month = 1; month <= 12; month++)
+				for (int left = calendar::month_length(year, month) - 1; left >= 0; left--)
+					delta[i++] = (unsigned char) left;
+	}
+} last_day_table;
+
+/* Month end of a date from the table when it is in range, else from block_month_end */
+static inline padb_udf::date_t table_month_end(padb_udf::date_t in_date)
+{
+	unsigned long long offset = (unsigned long long) ((long long) in_date - LAST_DAY_TABLE_FIRST);
+
+	if (offset < (unsigned long long) LAST_DAY_TABLE_DAYS)
+		return in_date + last_day_table.delta[offset];
+	return block_month_end(in_date);
+}
+
+/*
+ * An interval of normalize_time in microseconds with its reciprocal, so that the division per row becomes a
+ * multiply and two shifts: for shift = ceil(log2(divisor)) and magic = floor(2^64 * (2^shift - divisor) / divisor) + 1,
+ * n / divisor is ((n - t) / 2 + t) >> (shift - 1) with t the high word of magic * n, for every 64-bit n.
+ */
+struct interval_divisor
+{
+	padb_udf::int_t interval_spec;
+	unsigned long long divisor;
+	unsigned long long magic;
+	int shift;
+};
+
+/* Set up div for interval_spec seconds, which must not be 0; a negative interval counts as its magnitude */
+static inline void interval_divisor_init(interval_divisor &div, padb_udf::int_t interval_spec)
+{
+	long long seconds = interval_spec;
+
+	div.interval_spec = interval_spec;
+	div.divisor = (unsigned long long) ((seconds < 0 ? -seconds : seconds) * MICROSECOND);
+	div.shift = 64 - __builtin_clzll(div.divisor - 1);
+	div.magic = (unsigned long long) ((((unsigned __int128) 1 << 64) * ((1ULL << div.shift) - div.divisor)) / div.divisor) + 1;
+}
+
+/* n rounded down to a multiple of the interval */
+static inline unsigned long long interval_floor(const interval_divisor &div, unsigned long long n)
+{
+	unsigned long long t = (unsigned long long) (((unsigned __int128) div.magic * n) >> 64);
+
+	return ((((n - t) >> 1) + t) >> (div.shift - 1)) * div.divisor;
+}
+
+/*
+ * Start of the interval that in_ts falls in, counting intervals from base_ts <= in_ts.  The difference is taken
+ * unsigned, so any pair of timestamps works, and the result lies between the two.
+ */
+static inline padb_udf::timestamp_t interval_start(const interval_divisor &div, padb_udf::timestamp_t in_ts, padb_udf::timestamp_t base_ts)
+{
+	unsigned long long diff = (unsigned long long) in_ts - (unsigned long long) base_ts;
+
+	return (padb_udf::timestamp_t) ((unsigned long long) base_ts + interval_floor(div, diff));
+}
+
+#if defined(__AVX2__)
+/*
+ * The AVX2 loop of last_day_block loads four date_t at a time as packed 32-bit lanes.  A date_t of any other
+ * width takes the scalar loop instead.
+ */
+static constexpr bool block_date_lanes = sizeof(padb_udf::date_t) == 4;
+static_assert(sizeof(padb_udf::date_t) >= 4, "date_t holds every day number of the int32 range");
+
+/*
+ * floor(x / d) for integral x held in doubles.  Offsetting by half a step of 1/d keeps the rounding error of the
+ * reciprocal multiply from pulling an exact multiple below its quotient, and is far too small to push any other
+ * value over the next one.
+ */
+static inline __m256d block_floordiv(__m256d x, double d)
+{
+	return _mm256_floor_pd(_mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(1.0 / d)), _mm256_set1_pd(0.5 / d)));
+}
+
+/* block_month_end on four dates at a time, following calendar::month_end step by step */
+static inline __m128i block_month_end4(__m128i in_dates)
+{
+	__m256d x = _mm256_cvtepi32_pd(in_dates);
+	__m256d z = _mm256_add_pd(x, _mm256_set1_pd(DATE_EPOCH_DAYS + calendar::detail::civil_epoch));
+	__m256d era = block_floordiv(z, 146097);
+	__m256d doe = _mm256_sub_pd(z, _mm256_mul_pd(era, _mm256_set1_pd(146097)));
+	__m256d yoe = block_floordiv(_mm256_add_pd(_mm256_sub_pd(doe, block_floordiv(doe, 1460)),
+		_mm256_sub_pd(block_floordiv(doe, 36524), block_floordiv(doe, 146096))), 365);
+	__m256d yoe1 = _mm256_add_pd(yoe, _mm256_set1_pd(1));
+	__m256d doy = _mm256_sub_pd(doe, _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(yoe, _mm256_set1_pd(365)), block_floordiv(yoe, 4)),
+		block_floordiv(yoe, 100)));
+	__m256d mp = block_floordiv(_mm256_add_pd(_mm256_mul_pd(doy, _mm256_set1_pd(5)), _mm256_set1_pd(2)), 153);
+	__m256d year_len = _mm256_add_pd(_mm256_set1_pd(365),
+		_mm256_add_pd(_mm256_sub_pd(block_floordiv(yoe1, 4), block_floordiv(yoe, 4)),
+		_mm256_sub_pd(block_floordiv(yoe1, 400), _mm256_sub_pd(block_floordiv(yoe1, 100), block_floordiv(yoe, 100)))));
+	__m256d end_doy = _mm256_sub_pd(block_floordiv(_mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(mp, _mm256_set1_pd(1)),
+		_mm256_set1_pd(153)), _mm256_set1_pd(2)), 5), _mm256_set1_pd(1));
+
+	end_doy = _mm256_min_pd(end_doy, _mm256_sub_pd(year_len, _mm256_set1_pd(1)));
+	return _mm256_cvtpd_epi32(_mm256_add_pd(_mm256_sub_pd(x, doy), end_doy));
+}
+#endif
+
 PADB_UDF_VERSION(last_day)
 PADB_UDF_VERSION(last_daytstamp)
 PADB_UDF_VERSION(format_duration)
@@ -24,11 +164,12 @@ extern "C"
 	}
 	padb_udf::timestamp_t normalize_time(padb_udf::ScalarArg &aux, padb_udf::timestamp_t in_ts, padb_udf::timestamp_t base_ts, padb_udf::int_t interval_spec)
 	{
-		padb_udf::timestamp_t ret_ts;
-		padb_udf::num_microsec_t ts_diff;
-		padb_udf::int_t nearest_lb_multiple;
-		padb_udf::int_t nearest_lb_remain;
-		
+		/*
+		 * interval_spec is nearly always a constant of the query, so its reciprocal is only worked out again when it
+		 * changes.  The cache starts at interval 0, which is rejected before the comparison and so never matches.
+		 */
+		static thread_local interval_divisor div = { 0, 0, 0, 0 };
+
 		if (aux.isNull(0) || aux.isNull(1) || aux.isNull(2))
 			return aux.retTimeStampNull();
 		if (base_ts > in_ts)
@@ -36,20 +177,49 @@ extern "C"
 		   aux.throwError("normalize_timestamp", "Base timestamp cannot be greater than input timestamp");
 		   return aux.retTimeStampNull();
 		}
-		ts_diff = padb_udf::microsecondsBetween(in_ts, base_ts);
-		/* if we are at the interval -- just go ahead and return it */
-		if (ts_diff == (padb_udf::num_microsec_t) 0)
-			return aux.retTimeStampVal( in_ts );
-		/* if we are less than an interval away return the base */
-		if (ts_diff < (interval_spec * MICROSECOND))
-			return aux.retTimeStampVal( base_ts );
-		nearest_lb_remain = (padb_udf::int_t) (ts_diff % (interval_spec * MICROSECOND));
-		/* we are here -- return this one */
-		if (nearest_lb_remain == 0) 
-			return aux.retTimeStampVal( in_ts );
-		nearest_lb_multiple = (padb_udf::int_t) (ts_diff / (interval_spec * MICROSECOND));
-		ret_ts = base_ts + ((padb_udf::num_microsec_t) interval_spec * nearest_lb_multiple * MICROSECOND );
-		return aux.retTimeStampVal( ret_ts );
+		if (interval_spec == 0)
+		{
+			aux.throwError("normalize_timestamp", "Interval cannot be zero");
+			return aux.retTimeStampNull();
+		}
+		if (interval_spec != div.interval_spec)
+			interval_divisor_init(div, interval_spec);
+		/* in_ts itself when it is on an interval, base_ts when it is less than an interval away */
+		return aux.retTimeStampVal( interval_start(div, in_ts, base_ts) );
+	}
+
+	/*
+	 * Block form of normalize_time for a constant base_ts and interval_spec: out_ts[i] is in_ts[i] normalized, with
+	 * NULL rows marked in nulls and written as 0 as for last_day_block.  Like last_day_block it is not a SQL
+	 * function; aux only carries errors.
+	 */
+	void normalize_time_block(padb_udf::ScalarArg &aux, const padb_udf::timestamp_t *in_ts, const unsigned char *nulls, padb_udf::timestamp_t base_ts,
+		padb_udf::int_t interval_spec, padb_udf::int_t count, padb_udf::timestamp_t *out_ts)
+	{
+		interval_divisor div;
+		padb_udf::int_t i;
+
+		if (interval_spec == 0)
+		{
+			aux.throwError("normalize_timestamp", "Interval cannot be zero");
+			return;
+		}
+		interval_divisor_init(div, interval_spec);
+
+		for (i = 0; i < count; i++)
+		{
+			if (nulls != NULL && ((nulls[i >> 3] >> (i & 7)) & 1))
+			{
+				out_ts[i] = 0;
+				continue;
+			}
+			if (base_ts > in_ts[i])
+			{
+				aux.throwError("normalize_timestamp", "Base timestamp cannot be greater than input timestamp");
+				return;
+			}
+			out_ts[i] = interval_start(div, in_ts[i], base_ts);
+		}
 	}
 
 	padb_udf::varchar_t *format_duration(padb_udf::ScalarArg &aux, padb_udf::int_t nsecs)
@@ -82,18 +252,7 @@ extern "C"
 	}
 	padb_udf::date_t calc_lastdayofmonth(padb_udf::date_t in_date)
 	{
-		padb_udf::int_t m_last_days[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
-		padb_udf::year_t  cyear = padb_udf::extract_year_from_date(in_date);
-		padb_udf::month_t  cmon = padb_udf::extract_month_from_date(in_date);
-		padb_udf::day_of_month_t  cday = padb_udf::extract_day_from_date(in_date);
-		padb_udf::date_t retdate;
-
-		if (isleap(cyear) && cmon == 2)
-			retdate = padb_udf::date_plus_days(in_date, (29 - cday));
-		else
-			retdate = padb_udf::date_plus_days(in_date, m_last_days[cmon-1]-cday);
-
-		return retdate;
+		return table_month_end(in_date);
 	}
 		
 	padb_udf::date_t last_daytstamp(padb_udf::ScalarArg &aux, padb_udf::timestamp_t in_ts)
@@ -104,7 +263,7 @@ extern "C"
 		if (aux.isNull(0))
 			return aux.retDateNull();
 
-		cdate = padb_udf::extract_date_from_timestamp(in_ts);
+		cdate = (padb_udf::date_t) calendar::floor_div(in_ts, MICROSECONDS_PER_DAY);
 
 		retdate = calc_lastdayofmonth(cdate);
 		
@@ -122,4 +281,54 @@ extern "C"
 
 		return aux.retDateVal( retdate);
 	}
+
+	/*
+	 * Block forms of last_day and last_daytstamp: out_dates[i] is the month end of row i of count rows.  Bit i
+	 * of nulls (least significant bit first) marks row i NULL; nulls may be NULL if no row is.  A NULL row
+	 * stays NULL, so the caller keeps the same bitmap for the result, and its out_dates entry is 0.
+	 *
+	 * The block forms are not registered with PADB_UDF_VERSION and take no ScalarArg, so SQL cannot reach
+	 * them: the server calls last_day and last_daytstamp one row at a time.  They are plain C entry points for
+	 * code that links this library and already holds a column of values, such as a loader or an export job,
+	 * and bench/scalar_bench checks and measures them against the row forms.
+	 */
+	void last_day_block(const padb_udf::date_t *in_dates, const unsigned char *nulls, padb_udf::int_t count, padb_udf::date_t *out_dates)
+	{
+		padb_udf::int_t i = 0;
+
+#if defined(__AVX2__)
+		for (; block_date_lanes && i + 4 <= count; i += 4)
+		{
+			__m128i dates = _mm_loadu_si128((const __m128i *) (in_dates + i));
+			__m128i offset = _mm_sub_epi32(dates, _mm_set1_epi32((int) LAST_DAY_TABLE_FIRST));
+			__m128i outside = _mm_or_si128(_mm_cmplt_epi32(offset, _mm_setzero_si128()),
+				_mm_cmpgt_epi32(offset, _mm_set1_epi32((int) LAST_DAY_TABLE_DAYS - 1)));
+
+			/* Four table lookups at once when every date is in range, the arithmetic kernel otherwise */
+			if (_mm_testz_si128(outside, outside))
+				dates = _mm_add_epi32(dates, _mm_and_si128(_mm_i32gather_epi32((const int *) last_day_table.delta, offset, 1),
+					_mm_set1_epi32(0xff)));
+			else
+				dates = block_month_end4(dates);
+			_mm_storeu_si128((__m128i *) (out_dates + i), dates);
+		}
+#endif
+		for (; i < count; i++)
+			out_dates[i] = table_month_end(in_dates[i]);
+
+		if (nulls == NULL)
+			return;
+		for (i = 0; i < count; i++)
+			out_dates[i] &= ((nulls[i >> 3] >> (i & 7)) & 1) - 1;
+	}
+
+	void last_daytstamp_block(const padb_udf::timestamp_t *in_ts, const unsigned char *nulls, padb_udf::int_t count, padb_udf::date_t *out_dates)
+	{
+		padb_udf::int_t i;
+
+		/* Floor to whole days first; the month ends then come from the date kernel in place */
+		for (i = 0; i < count; i++)
+			out_dates[i] = (padb_udf::date_t) calendar::floor_div(in_ts[i], MICROSECONDS_PER_DAY);
+		last_day_block(out_dates, nulls, count, out_dates);
+	}
 }					
@@ -10,37 +10,474 @@
 ///
 /// <b>Named Parameters</b>
 ///
-/// PIVOTCOL is required and must be a column reference to the ON clause table_reference.
+/// PIVOTCOL is required and must be a column reference to the ON clause table_reference.  It may list up to 8 columns,
+/// in which case a row is mapped by the combination of their values and PHASE must be 'single'.
 ///
 /// GROUPCOL is required and must be a column reference to the ON clause table_reference.
 ///
 /// COLUMN_LIST is required and must be a string that represents a query that maps the column values to be the column_names to map to.
+/// The first column of the query holds the pivot keys and must be of the same type family as PIVOTCOL (integer, date and
+/// timestamp; float; numeric; or string).  Numeric keys match by value, so the two columns may differ in scale.  With a
+/// multi-column PIVOTCOL the first query columns hold the key, one per PIVOTCOL column and in the same order.  A float
+/// key column must have the width of its PIVOTCOL column, float4 or float8.  -0 matches 0 and NaN matches NaN.
+///
+/// COLUMN_LIST_VERSION is optional.  The COLUMN_LIST query normally runs once per statement.  When a version string is
+/// given, the result is kept in the process under the query text and the version, and later statements that pass the
+/// same pair do not run the query at all.  Change the version (for example to the load id or catalog version of the
+/// tables the query reads) whenever the result may have changed.
+///
+/// LOOKUP is optional and selects how pivot keys are resolved to columns: 'auto' (the default) uses a flat array for narrow
+/// integer key ranges and a hash map otherwise, 'hash' always uses the hash map, 'dense' requests the flat array and 'perfect'
+/// builds a minimal perfect hash over the COLUMN_LIST keys.  'sorted' also orders each group's input by PIVOTCOL and
+/// keeps the keys sorted, so that each row is found by stepping forward from the previous one instead of hashing; it
+/// suits maps with many keys per group.  A mode the keys cannot support falls back to the hash map; 'sorted' does not
+/// support a multi-column PIVOTCOL.
+///
+/// GROUPING is optional.  'partition' (the default) partitions the input by GROUPCOL so that each functor sees one group.
+/// 'stream' only orders each slice's input by GROUPCOL; one functor then walks through many groups and emits each wide
+/// row as soon as the group key changes.  With 'stream' the input must already be distributed on GROUPCOL, otherwise a
+/// group that spans slices is emitted once per slice.
+///
+/// AGGREGATE is optional and folds all rows that land in the same pivot cell instead of keeping the last one.  It is a
+/// comma separated list with one of 'none', 'sum', 'count', 'min', 'max' or 'avg' per PIVOTVAL column, or a single entry
+/// for all of them.  'count' applies to any column and yields a bigint.  'min' and 'max' need an integer, date,
+/// timestamp, float or numeric column and keep its type; 'sum' and 'avg' need an integer, float or numeric column.
+/// 'sum' yields bigint, float8 or numeric and 'avg' yields float8, or for numeric columns a numeric at the column's
+/// scale rounded half away from zero.  Integer and numeric sums are kept in a bigint and a numeric(38); a sum that
+/// overflows it raises an error.  A cell no row landed in stays NULL.
+///
+/// OUTPUT is optional.  'wide' (the default) emits one column per COLUMN_LIST key and PIVOTVAL column.  'packed' emits
+/// a single varchar column named cells instead, holding only the populated cells as a comma separated list of
+/// offset:value pairs in offset order.  The offset is the position the cell would have among the wide output's pivot
+/// columns, so row i of COLUMN_LIST and PIVOTVAL column v give offset i * (number of PIVOTVAL columns) + v.  Values
+/// are text; a comma or backslash inside a value is preceded by a backslash.  A group with no populated cell gets
+/// NULL.  'packed' only applies to PHASE 'single'.
+///
+/// BUCKET is optional and buckets the PIVOTCOL value before it is looked up, saving a projection through
+/// normalize_time or last_day.  A number of seconds rounds a timestamp PIVOTCOL down to a multiple of that interval
+/// from BUCKET_BASE, and COLUMN_LIST then holds timestamps.  'month' maps a date or timestamp PIVOTCOL to the last day
+/// of its month, and COLUMN_LIST then holds dates.  BUCKET_BASE is a timestamp 'YYYY-MM-DD[ HH:MI:SS]' and defaults to
+/// 2000-01-01; values before it fall in earlier buckets.  BUCKET needs a single PIVOTCOL column.
+///
+/// PHASE is optional and splits a pivot in two so that a skewed group is not pivoted on a single slice.  'single' (the
+/// default) pivots in one pass.  'partial' pivots each slice's local rows and emits, for every cell, a state column and
+/// a bigint count column (the number of values folded in, NULL if no row landed in the cell); 'avg' cells carry their
+/// sum as state.  'merge' takes the output of a 'partial' pivot as its input, with GROUPCOL naming the leading group
+/// columns, and combines the partial rows of each group into the final wide row.  For 'merge', PIVOTCOL and PIVOTVAL
+/// are not used; AGGREGATE is required and must list one aggregate per value column of the partial pivot, and
+/// COLUMN_LIST must be the same query.  The merge checks that its input has the columns and types a partial pivot over
+/// that query emits.
+///
+/// \b Unpivot
+///
+/// UNPIVOT ( ON table_reference WITH GROUPCOL ( groupcolumn ) PIVOTVAL ( value_column, ... ) COLUMN_LIST ( 'query of keys' ) )
+///
+/// The reverse transform.  Each input row becomes one row of (groupcolumns, key, value) per non-NULL PIVOTVAL column, in
+/// a single pass.  Row i of the COLUMN_LIST query supplies the key for the i-th PIVOTVAL column, so the query must return
+/// one row per PIVOTVAL column, and no key may repeat.  The PIVOTVAL columns must share one type and scale; the value
+/// column takes the largest length and precision among them.
 ///
 /// \b Example
 
 #include <cstdio>
-#include <unordered_map>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <strings.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+#include <unordered_set>
 #include <sstream>
 #include <string>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "vdb_udf.hpp"
 #include "vdb_udf_sql_client.hpp"
+#include "calendar.hpp"
 
 #define NPV_COLQRY "column_list"
 #define NPV_GROUPCOL "groupcol"
 #define NPV_PIVOTCOL "pivotcol"
 #define NPV_PIVOTVAL "pivotval"
+#define NPV_LOOKUP "lookup"
+#define NPV_GROUPING "grouping"
+#define NPV_AGGREGATE "aggregate"
+#define NPV_PHASE "phase"
+#define NPV_COLVERSION "column_list_version"
+#define NPV_OUTPUT "output"
+#define NPV_BUCKET "bucket"
+#define NPV_BUCKETBASE "bucket_base"
+
+// Integer keys whose range spans at most this many values, or at most PIVOT_DENSE_FILL times the
+// number of keys, are looked up through a flat array instead of the hash map.
+#define PIVOT_DENSE_MIN_SPAN 4096
+#define PIVOT_DENSE_MAX_SPAN (1 << 20)
+#define PIVOT_DENSE_FILL 8
+
+// Minimal perfect hash construction: average keys per displacement bucket and the number of seeds
+// tried for one bucket before the build gives up and falls back to the hash map.
+#define PIVOT_PERFECT_BUCKET_KEYS 3
+#define PIVOT_PERFECT_MAX_SEEDS (1 << 20)
+#define PIVOT_PERFECT_DIRECT 0x80000000U
+
+// Hash mode probes the slots in groups of this many control bytes.  An empty slot has the top bit set, a full
+// one holds the low 7 bits of its key's hash.
+#define PIVOT_GROUP_WIDTH 16
+#define PIVOT_CTRL_EMPTY 0x80
+
+// Most columns a composite PIVOTCOL key can have
+#define PIVOT_MAX_KEY_COLS 8
+
+// Session data blob identification; bump the version whenever the layout changes
+#define PIVOT_MAP_MAGIC 0x544d5650U
+#define PIVOT_MAP_VERSION 6
+
+// A PivotArena starts with a small chunk and doubles the chunk size up to the maximum
+#define PIVOT_ARENA_CHUNK 4096
+#define PIVOT_ARENA_MAX_CHUNK (1024 * 1024)
+
+// Most COLUMN_LIST results kept in the process at once, and seconds a Describe result waits for its Start
+#define PIVOT_COLUMN_LIST_CACHE_MAX 16
+#define PIVOT_COLUMN_LIST_HANDOFF_SECS 600
+
+// Largest magnitude of a numeric(38) 'sum' or 'avg' state
+#define PIVOT_NUMERIC_MAX ((vdb_udf::numeric_t) 10000000000000000000ULL * (vdb_udf::numeric_t) 10000000000000000000ULL - 1)
+
+// Declared length of the varchar column that OUTPUT 'packed' writes its cells into
+#define PIVOT_PACKED_MAX_LEN 65535
+
+// Dates count days and timestamps microseconds from 2000-01-01
+#define PIVOT_USECS_PER_DAY ((vdb_udf::bigint_t) 86400000000LL)
+#define PIVOT_USECS_PER_SECOND ((vdb_udf::bigint_t) 1000000)
+
+/// Decimal text of a numeric value with the given scale, e.g. 12345 at scale 2 is "123.45".  The magnitude is
+/// split into 19 digit chunks with at most two 128-bit divisions; the chunks are printed with 64-bit arithmetic.
+static void pivotFormatNumeric(vdb_udf::numeric_t value, vdb_udf::int_t scale, std::string &out)
+{
+	const uint64_t chunk = 10000000000000000000ULL;
+	char digits[64];
+	int pos = sizeof(digits);
+	__uint128_t mag = (value < 0) ? -(__uint128_t) value : (__uint128_t) value;
+	uint64_t parts[3];
+	int nparts = 0;
+
+	do
+	{
+		parts[nparts++] = (uint64_t) (mag % chunk);
+		mag /= chunk;
+	} while (mag != 0);
+
+	for (int p = 0; p < nparts; p++)
+	{
+		uint64_t part = parts[p];
+		int end = pos - 19;
+		do
+		{
+			digits[--pos] = '0' + (int) (part % 10);
+			part /= 10;
+		} while (part != 0);
+		// Inner chunks are zero padded to their full width
+		while (p + 1 < nparts && pos > end)
+			digits[--pos] = '0';
+	}
+	while ((int) sizeof(digits) - pos <= scale)
+		digits[--pos] = '0';
+
+	out.clear();
+	if (value < 0)
+		out.push_back('-');
+	out.append(digits + pos, sizeof(digits) - pos - scale);
+	if (scale > 0)
+	{
+		out.push_back('.');
+		out.append(digits + sizeof(digits) - scale, scale);
+	}
+}
+
+/// Average of count numeric values summing to sum, at their scale and rounded half away from zero
+static inline vdb_udf::numeric_t pivotNumericAvg(vdb_udf::numeric_t sum, vdb_udf::bigint_t count)
+{
+	vdb_udf::numeric_t q = sum / count;
+	vdb_udf::numeric_t r = sum % count;
+
+	if (2 * (r < 0 ? -r : r) >= count)
+		q += (sum < 0) ? -1 : 1;
+	return q;
+}
+
+/// Days from 2000-01-01 of a proleptic Gregorian date
+static inline vdb_udf::bigint_t pivotDaysFromCivil(vdb_udf::bigint_t y, vdb_udf::int_t m, vdb_udf::int_t d)
+{
+	return calendar::days_from_civil(y, m, d) - calendar::epoch_2000;
+}
+
+/// The last day of the month of a date, both as days from 2000-01-01
+static inline vdb_udf::bigint_t pivotMonthEnd(vdb_udf::bigint_t days)
+{
+	return calendar::month_end(days + calendar::epoch_2000) - calendar::epoch_2000;
+}
+
+/// How PivotMapTable resolves a key to its column offset.  Chosen at the Start command once the key set is known.
+/// PivotLookupAuto is only a request value; it is resolved to one of the other modes.  PivotLookupSorted keeps the
+/// entries in key order for a functor whose input arrives ordered by PIVOTCOL.
+enum PivotLookupMode
+{
+    PivotLookupHash = 0,
+    PivotLookupDense,
+    PivotLookupPerfect,
+    PivotLookupAuto,
+    PivotLookupSorted
+};
+
+/// Pivot keys are stored in their native representation so that the per-row lookup neither formats
+/// nor allocates.  Integer, date and timestamp keys are widened to 64 bits, float keys are held as the
+/// IEEE bit pattern of the value widened to float8, and numeric keys use both halves of the 128-bit value.
+/// String keys are kept in a separate string keyed map.
+enum PivotKeyClass
+{
+    PivotKeyNone = 0,
+    PivotKeyInteger,
+    PivotKeyFloat,
+    PivotKeyNumeric,
+    PivotKeyString
+};
+
+struct PivotKey
+{
+    uint64_t m_lo;
+    uint64_t m_hi;
+
+    PivotKey() : m_lo(0), m_hi(0) {}
+
+    inline bool operator ==(const PivotKey &other) const
+    {
+        return m_lo == other.m_lo && m_hi == other.m_hi;
+    }
+};
+
+/// 64-bit finalizer from MurmurHash3
+static inline uint64_t pivotMix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/// Map a 64-bit hash onto [0, n) with a multiply instead of a modulo
+static inline uint64_t pivotRange(uint64_t h, uint64_t n)
+{
+    return (uint64_t) (((__uint128_t) h * n) >> 64);
+}
+
+struct PivotKeyHash
+{
+    inline std::size_t operator ()(const PivotKey &key) const
+    {
+        // The high half is only non-zero for numeric keys
+        return (std::size_t) pivotMix64(key.m_lo ^ (key.m_hi * 0x9e3779b97f4a7c15ULL));
+    }
+};
+
+/// Header of the session data blob.  The blob is laid out as the header followed by 8-byte aligned sections:
+/// column positions (int_t per entry), the keys (PivotKey per entry, or for string maps an offsets array of
+/// entries+1 uint32 followed by the key bytes, or for composite keys m_key_count PivotKeys per entry followed by
+/// the bytes of their string components), then the lookup section of the chosen mode (hash slots,
+/// perfect hash seeds plus slot entries, or the dense position array; hash mode adds one control byte per slot and
+/// PIVOT_GROUP_WIDTH - 1 trailing copies of the first ones so that a group can be loaded from any slot).  The checksum covers every byte
+/// after the header.  m_slots counts the column positions, one per COLUMN_LIST row: it exceeds m_entries when a key
+/// repeats, since only the first row of a key is entered.
+struct PivotMapHeader
+{
+    uint32_t m_magic;
+    uint32_t m_version;
+    vdb_udf::int_t m_pivotcol_type;
+    vdb_udf::int_t m_pivotcol_len;
+    vdb_udf::int_t m_value_type;
+    vdb_udf::int_t m_value_len;
+    vdb_udf::int_t m_lookup_mode;
+    uint32_t m_entries;
+    uint32_t m_index_size;
+    vdb_udf::int_t m_pivotcol_scale;
+    vdb_udf::bigint_t m_dense_min;
+    uint64_t m_key_bytes;
+    uint64_t m_checksum;
+    vdb_udf::int_t m_key_count;
+    uint32_t m_slots;
+    vdb_udf::int_t m_key_types[PIVOT_MAX_KEY_COLS];
+    vdb_udf::int_t m_key_scales[PIVOT_MAX_KEY_COLS];
+};
+
+static inline uint64_t pivotAlign8(uint64_t n)
+{
+    return (n + 7) & ~(uint64_t) 7;
+}
 
-std::ostream& operator <<(std::ostream& ostr, __int128_t bigint)
+static inline uint64_t pivotRotl64(uint64_t x, int r)
 {
-	if (bigint < 0)
-		return ostr << '-' << bigint*-1;
-	if (bigint > std::numeric_limits<long long>::max())
-		return ostr << bigint / 1000000000000LL << (long long) (bigint%1000000000000LL);
-	return ostr << (long)(bigint);
+    return (x << r) | (x >> (64 - r));
+}
+
+/// Hash of a byte string.  Two independent lanes take 16 bytes per step with one multiply each; the full
+/// mix only runs once at the end.
+static inline uint64_t pivotHashBytes(const char *p, std::size_t len)
+{
+    const uint64_t k1 = 0x9e3779b97f4a7c15ULL;
+    const uint64_t k2 = 0xc2b2ae3d27d4eb4fULL;
+    uint64_t a = k2 ^ len;
+    uint64_t b = k1;
+    uint64_t w0;
+    uint64_t w1;
+    std::size_t n = len;
+
+    while (n >= 16)
+    {
+        memcpy(&w0, p, 8);
+        memcpy(&w1, p + 8, 8);
+        a = pivotRotl64((a ^ w0) * k1, 31);
+        b = pivotRotl64((b ^ w1) * k2, 29);
+        p += 16;
+        n -= 16;
+    }
+    if (n >= 8)
+    {
+        memcpy(&w0, p, 8);
+        a = pivotRotl64((a ^ w0) * k1, 31);
+        p += 8;
+        n -= 8;
+    }
+    if (n > 0)
+    {
+        w1 = 0;
+        memcpy(&w1, p, n);
+        b = pivotRotl64((b ^ w1) * k2, 29);
+    }
+    return pivotMix64(a ^ pivotRotl64(b, 17));
 }
 
-/// The key-value pair map is a session object.  Map entries are added at the Start command.
+/// Bump allocator owned by one functor, that is one partition, or by one Describe or Start command.  Memory is
+/// carved out of large chunks and handed back only in one shot, by release() or with the owner.
+class PivotArena
+{
+public:
+    PivotArena()
+    {
+        m_head = NULL;
+        m_cur = NULL;
+        m_end = NULL;
+        m_next_chunk = PIVOT_ARENA_CHUNK;
+    }
+
+    ~PivotArena()
+    {
+        release();
+    }
+
+    void *allocate(std::size_t size, std::size_t align)
+    {
+        char *p = (char *) (((uintptr_t) m_cur + align - 1) & ~(uintptr_t) (align - 1));
+
+        if (m_cur == NULL || p + size > m_end)
+        {
+            // Oversized requests get a chunk of their own
+            std::size_t chunk = std::max(m_next_chunk, size + align + sizeof(Chunk));
+            m_next_chunk = std::min(m_next_chunk * 2, (std::size_t) PIVOT_ARENA_MAX_CHUNK);
+            Chunk *c = (Chunk *) malloc(chunk);
+            if (c == NULL)
+                throw std::bad_alloc();
+            c->m_next = m_head;
+            m_head = c;
+            m_cur = (char *) (c + 1);
+            m_end = (char *) c + chunk;
+            p = (char *) (((uintptr_t) m_cur + align - 1) & ~(uintptr_t) (align - 1));
+        }
+        m_cur = p + size;
+        return p;
+    }
+
+    void release()
+    {
+        while (m_head != NULL)
+        {
+            Chunk *next = m_head->m_next;
+            free(m_head);
+            m_head = next;
+        }
+        m_cur = NULL;
+        m_end = NULL;
+    }
+
+private:
+    struct Chunk
+    {
+        Chunk *m_next;
+        uint64_t m_pad;
+    };
+
+    Chunk *m_head;
+    char *m_cur;
+    char *m_end;
+    std::size_t m_next_chunk;
+
+    PivotArena(const PivotArena &);
+    PivotArena &operator =(const PivotArena &);
+};
+
+/// Standard allocator over a PivotArena so that the pivot containers draw from their functor's arena.
+/// Deallocation is a no-op; the arena returns everything at once.
+template <typename T>
+class PivotArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    PivotArena *m_arena;
+
+    explicit PivotArenaAllocator(PivotArena &arena) : m_arena(&arena) {}
+
+    template <typename U>
+    PivotArenaAllocator(const PivotArenaAllocator<U> &other) : m_arena(other.m_arena) {}
+
+    T *allocate(std::size_t n)
+    {
+        return (T *) m_arena->allocate(n * sizeof(T), alignof(T));
+    }
+
+    void deallocate(T *, std::size_t)
+    {
+    }
+
+    template <typename U>
+    inline bool operator ==(const PivotArenaAllocator<U> &other) const { return m_arena == other.m_arena; }
+    template <typename U>
+    inline bool operator !=(const PivotArenaAllocator<U> &other) const { return m_arena != other.m_arena; }
+};
+
+typedef std::basic_string<char, std::char_traits<char>, PivotArenaAllocator<char> > PivotArenaString;
+
+struct PivotArenaStringHash
+{
+    inline std::size_t operator ()(const PivotArenaString &key) const
+    {
+        return (std::size_t) pivotHashBytes(key.data(), key.size());
+    }
+};
+
+/// The key-value pair map is a session object.  Map entries are added at the Start command, which then
+/// freezes the map into one contiguous, versioned blob.  The blob is what travels as session data, and
+/// every lookup reads it in place, so deserializing is one copy plus a checksum with no per-entry allocation.
+/// The containers used while adding keys draw from the owner's PivotArena.  The blob itself is a plain
+/// std::string because the Serializer reads into one directly; it is a single allocation.
 class PivotMapTable : public vdb_udf::SessionObject
 {
 public:
@@ -50,42 +487,101 @@ public:
     vdb_udf::int_t m_value_len;
     vdb_udf::int_t m_pivotcol_type;
     vdb_udf::int_t m_pivotcol_len;
-    typedef std::unordered_map<std::string, vdb_udf::int_t> unordered_pmap; 
-    unordered_pmap m_map_values;
+    vdb_udf::int_t m_pivotcol_scale;
+    vdb_udf::int_t m_lookup_mode;
+    // Key columns.  A single column key also has its type and scale in m_pivotcol_type and m_pivotcol_scale.
+    vdb_udf::int_t m_key_count;
+    vdb_udf::int_t m_key_types[PIVOT_MAX_KEY_COLS];
+    vdb_udf::int_t m_key_scales[PIVOT_MAX_KEY_COLS];
 
-    void serialize(vdb_udf::Serializer &s)
+    /// Hashes and compares composite entries by index so that add() can deduplicate them in place
+    struct CompositeEntryHash
     {
-        // Serialize key-value column indices from named parameters
-        vdb_udf::int_t entries = m_map_values.size();
-
-        // Serialize metadata
-        s << m_pivotcol_type << m_pivotcol_len << m_value_type << m_value_len << entries;
-
-        // Serialize key-value pair
-        for (unordered_pmap::const_iterator it = m_map_values.begin(); it != m_map_values.end(); ++it)
+        PivotMapTable *m_map;
+        explicit CompositeEntryHash(PivotMapTable *map) : m_map(map) {}
+        inline std::size_t operator ()(uint32_t e) const { return (std::size_t) m_map->entryHash(e); }
+    };
+    struct CompositeEntryEqual
+    {
+        PivotMapTable *m_map;
+        explicit CompositeEntryEqual(PivotMapTable *map) : m_map(map) {}
+        inline bool operator ()(uint32_t a, uint32_t b) const
         {
-			std::string *data = new std::string(it->first);
-            s << *((std::string*)data);
-			s << (vdb_udf::int_t)it->second;
+            return m_map->compositeMatch(&m_map->m_add_keys[(std::size_t) b * m_map->m_key_count], m_map->m_add_bytes.data(),
+                &m_map->m_add_keys[(std::size_t) a * m_map->m_key_count], m_map->m_add_bytes.data());
         }
+    };
+
+    // Keys collected by add() before the map is frozen, deduplicated in arrival order
+    typedef std::unordered_set<PivotKey, PivotKeyHash, std::equal_to<PivotKey>, PivotArenaAllocator<PivotKey> > arena_kset;
+    typedef std::unordered_set<PivotArenaString, PivotArenaStringHash, std::equal_to<PivotArenaString>,
+        PivotArenaAllocator<PivotArenaString> > arena_sset;
+    PivotArena &m_arena;
+    arena_kset m_add_seen;
+    arena_sset m_add_seen_strings;
+    std::unordered_set<uint32_t, CompositeEntryHash, CompositeEntryEqual, PivotArenaAllocator<uint32_t> > m_add_seen_composite;
+    std::vector<PivotKey, PivotArenaAllocator<PivotKey> > m_add_keys;
+    std::vector<uint32_t, PivotArenaAllocator<uint32_t> > m_add_offsets;
+    PivotArenaString m_add_bytes;
+    std::vector<vdb_udf::int_t, PivotArenaAllocator<vdb_udf::int_t> > m_add_positions;
+    uint32_t m_add_slots;
+
+    // Frozen map.  All pointers below point into m_blob.
+    std::string m_blob;
+    vdb_udf::bool_t m_valid;
+    uint32_t m_entries;
+    uint32_t m_slots;
+    uint64_t m_index_size;
+    vdb_udf::bigint_t m_dense_min;
+    vdb_udf::int_t *m_positions;
+    PivotKey *m_keys;
+    uint32_t *m_key_offsets;
+    char *m_key_bytes;
+    uint32_t *m_index;
+    uint32_t *m_perfect_entries;
+    uint8_t *m_ctrl;
+    vdb_udf::int_t *m_dense;
+
+    /// The blob is preceded by its size and identity so that a receiver can find a copy it already holds
+    void serialize(vdb_udf::Serializer &s)
+    {
+        uint64_t id = identity();
+
+        s << (vdb_udf::int_t) m_blob.size();
+        s << (vdb_udf::int_t) (uint32_t) id;
+        s << (vdb_udf::int_t) (uint32_t) (id >> 32);
+        s << m_blob;
     }
 
     void deserialize(vdb_udf::Serializer &s) 
     {
-        vdb_udf::int_t entries;
+        vdb_udf::int_t size, idLo, idHi;
 
-        // Same order as serialize
-        s >> m_pivotcol_type >> m_pivotcol_len >> m_value_type >> m_value_len >> entries;
+        s >> size;
+        s >> idLo;
+        s >> idHi;
+        readBlob(s);
+    }
+
+    /// Read the blob that follows the identity in the session data
+    void readBlob(vdb_udf::Serializer &s)
+    {
+        s >> m_blob;
+        attach();
+    }
 
-		vdb_udf::int_t data;
+    /// Hash of the header, which holds the checksum of the rest of the blob
+    uint64_t identity()
+    {
+        uint64_t h = PIVOT_MAP_MAGIC;
+        uint64_t w;
 
-        for (vdb_udf::int_t i=0; i<entries; i++)
-        {      
-			std::string *val = new std::string;
-            s >> *val ;
-			s >> data;
-			m_map_values.insert(unordered_pmap::value_type(*val, data));
+        for (std::size_t i = 0; i + 8 <= sizeof(PivotMapHeader) && i + 8 <= m_blob.size(); i += 8)
+        {
+            memcpy(&w, m_blob.data() + i, 8);
+            h = pivotMix64(h ^ w) + i;
         }
+        return h;
     }
 
     void setPivotValType(vdb_udf::int_t v, vdb_udf::int_t len)
@@ -93,286 +589,3479 @@ public:
         m_value_type = v;
         m_value_len = len;
     }
-    void setPivotColType(vdb_udf::int_t v, vdb_udf::int_t len)
+    void setPivotColType(vdb_udf::int_t v, vdb_udf::int_t len, vdb_udf::int_t scale)
     {
 		m_pivotcol_type = v;
 		m_pivotcol_len = len;
+		m_pivotcol_scale = scale;
+		m_key_count = 1;
+		m_key_types[0] = v;
+		m_key_scales[0] = scale;
     }
 
-    void add(vdb_udf::RowDesc *row_p, vdb_udf::int_t colpos) 
+    /// Key the map on the first count columns of each added row
+    void setCompositeKey(vdb_udf::int_t count, const vdb_udf::int_t *types, const vdb_udf::int_t *scales)
     {
-	std::string key; 
-	std::ostringstream keycvt;
-	vdb_udf::timestamp_t mytimestamp;
-	vdb_udf::bigint_t mybigint;
-	vdb_udf::numeric_t mynumeric;
-	vdb_udf::int_t myint;
-	vdb_udf::date_t mydate;
-	vdb_udf::smallint_t mysmallint;
-	vdb_udf::float4_t myfloat4;
-	vdb_udf::float8_t myfloat8;
-	vdb_udf::bool_t convert_final = true;
-	switch(m_pivotcol_type)
-	{
-	    case vdb_udf::TypeTimeStamp:
-		mytimestamp = row_p->getTimeStamp(0);	
-		keycvt << (vdb_udf::bigint_t) mytimestamp;
-		break;
+		setPivotColType(types[0], 0, scales[0]);
+		m_key_count = count;
+		for (vdb_udf::int_t k = 0; k < count; k++)
+		{
+			m_key_types[k] = types[k];
+			m_key_scales[k] = scales[k];
+		}
+    }
+
+    /// Map a column type to the family of keys it produces.  Keys only match within a family.
+    static PivotKeyClass keyClass(vdb_udf::int_t coltype)
+    {
+        switch (coltype)
+        {
+            case vdb_udf::TypeTimeStamp:
+            case vdb_udf::TypeBigInt:
+            case vdb_udf::TypeInt:
+            case vdb_udf::TypeDate:
+            case vdb_udf::TypeSmallInt:
+                return PivotKeyInteger;
+            case vdb_udf::TypeFloat4:
+            case vdb_udf::TypeFloat8:
+                return PivotKeyFloat;
+            case vdb_udf::TypeNumeric:
+                return PivotKeyNumeric;
+            case vdb_udf::TypeVarChar:
+            case vdb_udf::TypeBpChar:
+                return PivotKeyString;
+            default:
+                return PivotKeyNone;
+        }
+    }
+
+    /// Whether keys of column type a can find keys of column type b.  Float keys must also have the same width: a
+    /// float4 value widened to float8 is not the float8 literal it was rounded from, so 0.1 would never match.
+    static vdb_udf::bool_t keyTypesMatch(vdb_udf::int_t a, vdb_udf::int_t b)
+    {
+        return keyClass(a) != PivotKeyNone && keyClass(a) == keyClass(b) && (keyClass(a) != PivotKeyFloat || a == b);
+    }
+
+    inline vdb_udf::bool_t isStringMap() { return m_key_count == 1 && keyClass(m_pivotcol_type) == PivotKeyString; }
+    inline vdb_udf::bool_t isComposite() { return m_key_count > 1; }
+
+    /// Bytes of a string component.  Stored components hold an offset into base; probe components, which have no
+    /// base, hold the address of the row's bytes.
+    static inline const char *componentBytes(const char *base, const PivotKey &key)
+    {
+        return base != NULL ? base + key.m_lo : (const char *) (uintptr_t) key.m_lo;
+    }
+
+    /// Hash of a composite key, combining the native hash of each component
+    inline uint64_t compositeHash(const PivotKey *keys, const char *base)
+    {
+        uint64_t h = 0x9e3779b97f4a7c15ULL * (uint64_t) m_key_count;
+
+        for (vdb_udf::int_t k = 0; k < m_key_count; k++)
+        {
+            uint64_t ch;
+            if (keyClass(m_key_types[k]) == PivotKeyString)
+                ch = pivotHashBytes(componentBytes(base, keys[k]), (std::size_t) keys[k].m_hi);
+            else
+                ch = PivotKeyHash()(keys[k]);
+            h = (pivotRotl64(h, 27) ^ ch) * 0xc2b2ae3d27d4eb4fULL;
+        }
+        return pivotMix64(h);
+    }
+
+    inline vdb_udf::bool_t compositeMatch(const PivotKey *a, const char *abase, const PivotKey *b, const char *bbase)
+    {
+        for (vdb_udf::int_t k = 0; k < m_key_count; k++)
+        {
+            if (keyClass(m_key_types[k]) == PivotKeyString)
+            {
+                if (a[k].m_hi != b[k].m_hi ||
+                    memcmp(componentBytes(abase, a[k]), componentBytes(bbase, b[k]), (std::size_t) a[k].m_hi) != 0)
+                    return false;
+            }
+            else if (!(a[k] == b[k]))
+                return false;
+        }
+        return true;
+    }
+
+    /// Build the native key for a non-string column.  No formatting and no allocation.
+    static inline void readKey(vdb_udf::RowDesc *row_p, vdb_udf::ColumnIndex col, vdb_udf::int_t coltype, PivotKey &key)
+    {
+        switch (coltype)
+        {
+            case vdb_udf::TypeTimeStamp:
+                readKeyAs<vdb_udf::TypeTimeStamp>(row_p, col, key);
+                break;
             case vdb_udf::TypeBigInt:
-                mybigint = row_p->getBigInt(0);
-				keycvt << mybigint;
+                readKeyAs<vdb_udf::TypeBigInt>(row_p, col, key);
                 break;
             case vdb_udf::TypeNumeric:
-                mynumeric = row_p->getNumeric(0);
-				keycvt << (vdb_udf::numeric_t) mynumeric;
+                readKeyAs<vdb_udf::TypeNumeric>(row_p, col, key);
                 break;
             case vdb_udf::TypeInt:
-                myint = row_p->getInt(0);
-				keycvt << myint;
+                readKeyAs<vdb_udf::TypeInt>(row_p, col, key);
                 break;
             case vdb_udf::TypeDate:
-                mydate = row_p->getDate(0);
-				keycvt << mydate;
+                readKeyAs<vdb_udf::TypeDate>(row_p, col, key);
                 break;
             case vdb_udf::TypeSmallInt:
-                mysmallint = row_p->getSmallInt(0);
-				keycvt << mysmallint;
+                readKeyAs<vdb_udf::TypeSmallInt>(row_p, col, key);
                 break;
             case vdb_udf::TypeFloat4:
-                myfloat4 = row_p->getFloat4(0);
-				keycvt << myfloat4;
+                readKeyAs<vdb_udf::TypeFloat4>(row_p, col, key);
                 break;
             case vdb_udf::TypeFloat8:
-                myfloat8 = row_p->getFloat8(0);
-				keycvt << myfloat8;
+                readKeyAs<vdb_udf::TypeFloat8>(row_p, col, key);
                 break;
-            case vdb_udf::TypeVarChar:
-            case vdb_udf::TypeBpChar:
-                row_p->getValueAsString(0, key);
-				convert_final = false;
+            default:
+                key.m_lo = 0;
+                key.m_hi = 0;
+                break;
+        }
+    }
+
+    /// readKey for a column type known at compile time; the switch folds away
+    template <vdb_udf::int_t KeyType>
+    static inline void readKeyAs(vdb_udf::RowDesc *row_p, vdb_udf::ColumnIndex col, PivotKey &key)
+    {
+        vdb_udf::numeric_t mynumeric;
+
+        key.m_hi = 0;
+        switch (KeyType)
+        {
+            case vdb_udf::TypeTimeStamp:
+                key.m_lo = (uint64_t) (vdb_udf::bigint_t) row_p->getTimeStamp(col);
+                break;
+            case vdb_udf::TypeBigInt:
+                key.m_lo = (uint64_t) row_p->getBigInt(col);
+                break;
+            case vdb_udf::TypeNumeric:
+                mynumeric = row_p->getNumeric(col);
+                key.m_lo = (uint64_t) mynumeric;
+                key.m_hi = (uint64_t) (mynumeric >> 64);
+                break;
+            case vdb_udf::TypeInt:
+                key.m_lo = (uint64_t) (vdb_udf::bigint_t) row_p->getInt(col);
+                break;
+            case vdb_udf::TypeDate:
+                key.m_lo = (uint64_t) (vdb_udf::bigint_t) row_p->getDate(col);
+                break;
+            case vdb_udf::TypeSmallInt:
+                key.m_lo = (uint64_t) (vdb_udf::bigint_t) row_p->getSmallInt(col);
+                break;
+            case vdb_udf::TypeFloat4:
+                key.m_lo = floatBits((vdb_udf::float8_t) row_p->getFloat4(col));
+                break;
+            case vdb_udf::TypeFloat8:
+                key.m_lo = floatBits(row_p->getFloat8(col));
+                break;
+            default:
+                key.m_lo = 0;
+                break;
+        }
+    }
+
+    /// Canonical bit pattern of a float key: -0 becomes +0 and every NaN the same quiet NaN, so that values SQL
+    /// treats as equal share a key.  float4 values are widened first, which is exact.
+    static inline uint64_t floatBits(vdb_udf::float8_t value)
+    {
+        uint64_t bits;
+
+        if (value == 0)
+            return 0;
+        if (value != value)
+            return 0x7ff8000000000000ULL;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    /// Point at the bytes of a string column without copying them.  Trailing blanks of a bpchar value are padding
+    /// and are left out, so 'a' and 'a  ' are the same key.
+    static inline const char *readString(vdb_udf::RowDesc *row_p, vdb_udf::ColumnIndex col, vdb_udf::int_t coltype, std::size_t &len)
+    {
+        vdb_udf::int_t rawlen = 0;
+        const char *p;
+
+        if (coltype == vdb_udf::TypeBpChar)
+        {
+            p = row_p->getBpChar(col, &rawlen);
+            while (rawlen > 0 && p[rawlen - 1] == ' ')
+                rawlen--;
+        }
+        else
+            p = row_p->getVarChar(col, &rawlen);
+        len = (std::size_t) rawlen;
+        return p;
+    }
+
+    /// Render a key as text.  Only used for error messages, never on the per-row path.
+    void formatKey(const PivotKey &key, std::string &out)
+    {
+        formatValue(m_pivotcol_type, m_pivotcol_scale, key, out);
+    }
+
+    /// Render a composite probe key as "(a, b, ...)"
+    void formatKey(const PivotKey *keys, std::string &out)
+    {
+        std::string value;
+
+        out = "(";
+        for (vdb_udf::int_t k = 0; k < m_key_count; k++)
+        {
+            if (keyClass(m_key_types[k]) == PivotKeyString)
+                value.assign(componentBytes(NULL, keys[k]), (std::size_t) keys[k].m_hi);
+            else
+                formatValue(m_key_types[k], m_key_scales[k], keys[k], value);
+            out.append(k > 0 ? ", " : "").append(value);
+        }
+        out.append(")");
+    }
+
+    /// Render a non-string key of the given column type and scale as text
+    static void formatValue(vdb_udf::int_t coltype, vdb_udf::int_t scale, const PivotKey &key, std::string &out)
+    {
+        std::ostringstream keycvt;
+        vdb_udf::float8_t myfloat8;
+
+        switch (keyClass(coltype))
+        {
+            case PivotKeyInteger:
+                keycvt << (vdb_udf::bigint_t) key.m_lo;
+                break;
+            case PivotKeyFloat:
+                // Enough digits to tell apart any two keys the map distinguishes
+                memcpy(&myfloat8, &key.m_lo, sizeof(myfloat8));
+                if (coltype == vdb_udf::TypeFloat4)
+                    keycvt.precision(std::numeric_limits<vdb_udf::float4_t>::max_digits10);
+                else
+                    keycvt.precision(std::numeric_limits<vdb_udf::float8_t>::max_digits10);
+                keycvt << myfloat8;
                 break;
+            case PivotKeyNumeric:
+                pivotFormatNumeric((vdb_udf::numeric_t) (((__uint128_t) key.m_hi << 64) | key.m_lo), scale, out);
+                return;
             default:
                 break;
+        }
+        out = keycvt.str();
+    }
+
+    void add(vdb_udf::RowDesc *row_p, vdb_udf::int_t colpos) 
+    {
+	// A repeated key keeps the position of its first row, but every row still has its column slot
+	m_add_slots = std::max(m_add_slots, (uint32_t) colpos + 1);
+	if (isComposite())
+	{
+	    // Append the components, then take them back if the key was already added
+	    uint32_t e = (uint32_t) m_add_positions.size();
+	    std::size_t bytes = m_add_bytes.size();
+	    for (vdb_udf::int_t k = 0; k < m_key_count; k++)
+	    {
+	        PivotKey key;
+	        if (keyClass(m_key_types[k]) == PivotKeyString)
+	        {
+	            std::size_t len;
+	            const char *p = readString(row_p, k, m_key_types[k], len);
+	            key.m_lo = m_add_bytes.size();
+	            key.m_hi = len;
+	            m_add_bytes.append(p, len);
+	        }
+	        else
+	            readKey(row_p, k, m_key_types[k], key);
+	        m_add_keys.push_back(key);
+	    }
+	    if (!m_add_seen_composite.insert(e).second)
+	    {
+	        m_add_keys.resize((std::size_t) e * m_key_count);
+	        m_add_bytes.resize(bytes);
+	        return;
+	    }
 	}
+	else if (isStringMap())
+	{
+	    std::size_t len;
+	    const char *key = readString(row_p, 0, m_pivotcol_type, len);
+	    if (!m_add_seen_strings.insert(PivotArenaString(key, len, PivotArenaAllocator<char>(m_arena))).second)
+	        return;
+	    if (m_add_offsets.empty())
+	        m_add_offsets.push_back(0);
+	    m_add_bytes.append(key, len);
+	    m_add_offsets.push_back((uint32_t) m_add_bytes.size());
+	}
+	else
+	{
+	    PivotKey key;
+	    readKey(row_p, 0, m_pivotcol_type, key);
+	    if (!m_add_seen.insert(key).second)
+	        return;
+	    m_add_keys.push_back(key);
+	}
+	m_add_positions.push_back(colpos);
+    }
+
+    /// The frozen blob, for keeping a built map beyond the arena it was built in
+    inline const std::string &getBlob() { return m_blob; }
 
-	if (convert_final)
-	    key = keycvt.str();
-		m_map_values.insert(unordered_pmap::value_type(key, colpos));
+    /// Take over a blob frozen by another map, as deserialize does
+    void adopt(const std::string &blob)
+    {
+        m_blob = blob;
+        attach();
     }
 
-    vdb_udf::int_t findcolumnoffset(vdb_udf::TableArg &arg, std::string key)
+    /// Freeze the added keys into the session blob, picking the lookup mode for the final key set.
+    /// Called once by the Start command after the last add.  A mode the key set cannot support falls
+    /// back to the next best one.
+    void chooseLookup(vdb_udf::int_t requested)
     {
-        unordered_pmap::iterator it = m_map_values.find(key);
+        PivotMapHeader header;
+        std::vector<uint32_t> seeds;
+        uint32_t entries = (uint32_t) m_add_positions.size();
+        vdb_udf::bigint_t kmin = 0;
 
-        // Set to null if no match found
-        if (it == m_map_values.end())
+        memset(&header, 0, sizeof(header));
+        m_lookup_mode = PivotLookupHash;
+        if ((requested == PivotLookupAuto || requested == PivotLookupDense) && denseFits(kmin, header.m_index_size))
         {
-            return(-1);
+            m_lookup_mode = PivotLookupDense;
+            header.m_dense_min = kmin;
         }
+        else if (requested == PivotLookupPerfect && entries > 0 && searchPerfectSeeds(seeds))
+        {
+            m_lookup_mode = PivotLookupPerfect;
+            header.m_index_size = (uint32_t) seeds.size();
+        }
+        else if (requested == PivotLookupSorted && !isComposite())
+        {
+            // The entries themselves are the index
+            m_lookup_mode = PivotLookupSorted;
+            sortAdded();
+        }
+        else
+        {
+            header.m_index_size = PIVOT_GROUP_WIDTH;
+            while (header.m_index_size < 2 * (uint64_t) entries)
+                header.m_index_size <<= 1;
+        }
+
+        header.m_magic = PIVOT_MAP_MAGIC;
+        header.m_version = PIVOT_MAP_VERSION;
+        header.m_pivotcol_type = m_pivotcol_type;
+        header.m_pivotcol_len = m_pivotcol_len;
+        header.m_pivotcol_scale = m_pivotcol_scale;
+        header.m_value_type = m_value_type;
+        header.m_value_len = m_value_len;
+        header.m_lookup_mode = m_lookup_mode;
+        header.m_entries = entries;
+        header.m_slots = m_add_slots;
+        header.m_key_bytes = m_add_bytes.size();
+        header.m_key_count = m_key_count;
+        memcpy(header.m_key_types, m_key_types, sizeof(m_key_types));
+        memcpy(header.m_key_scales, m_key_scales, sizeof(m_key_scales));
+
+        m_blob.assign(blobSize(header), '\0');
+        memcpy(&m_blob[0], &header, sizeof(header));
+        layout();
+
+        if (entries > 0)
+            memcpy(m_positions, &m_add_positions[0], entries * sizeof(vdb_udf::int_t));
+        if (isStringMap())
+        {
+            if (entries > 0)
+                memcpy(m_key_offsets, &m_add_offsets[0], (entries + 1) * sizeof(uint32_t));
+            if (!m_add_bytes.empty())
+                memcpy(m_key_bytes, m_add_bytes.data(), m_add_bytes.size());
+        }
+        else if (entries > 0)
+        {
+            memcpy(m_keys, &m_add_keys[0], (std::size_t) entries * m_key_count * sizeof(PivotKey));
+            if (isComposite() && !m_add_bytes.empty())
+                memcpy(m_key_bytes, m_add_bytes.data(), m_add_bytes.size());
+        }
+
+        if (m_lookup_mode == PivotLookupDense)
+        {
+            for (uint64_t i = 0; i < m_index_size; i++)
+                m_dense[i] = -1;
+            for (uint32_t e = 0; e < entries; e++)
+                m_dense[(uint64_t) m_keys[e].m_lo - (uint64_t) m_dense_min] = m_positions[e];
+        }
+        else if (m_lookup_mode == PivotLookupSorted)
+        {
+        }
+        else if (m_lookup_mode == PivotLookupPerfect)
+        {
+            memcpy(m_index, &seeds[0], seeds.size() * sizeof(uint32_t));
+            for (uint32_t e = 0; e < entries; e++)
+                m_perfect_entries[perfectSlot(entryHash(e), m_index[pivotRange(entryHash(e), m_index_size)], m_entries)] = e;
+        }
+        else
+        {
+            memset(m_ctrl, PIVOT_CTRL_EMPTY, m_index_size + PIVOT_GROUP_WIDTH - 1);
+            for (uint32_t e = 0; e < entries; e++)
+            {
+                uint64_t h = entryHash(e);
+                uint64_t slot = (h >> 7) & (m_index_size - 1);
+                while (m_index[slot] != 0)
+                    slot = (slot + 1) & (m_index_size - 1);
+                m_index[slot] = e + 1;
+                m_ctrl[slot] = (uint8_t) (h & 0x7f);
+                if (slot < PIVOT_GROUP_WIDTH - 1)
+                    m_ctrl[m_index_size + slot] = (uint8_t) (h & 0x7f);
+            }
+        }
+
+        ((PivotMapHeader *) &m_blob[0])->m_checksum = checksum();
+        m_valid = true;
+
+        m_add_seen.clear();
+        m_add_seen_strings.clear();
+        m_add_seen_composite.clear();
+        m_add_keys.clear();
+        m_add_offsets.clear();
+        m_add_bytes.clear();
+        m_add_positions.clear();
+        m_add_slots = 0;
+    }
+
+    /// Reorder the added entries by key for PivotLookupSorted
+    void sortAdded()
+    {
+        std::vector<uint32_t> order(m_add_positions.size());
+        std::vector<vdb_udf::int_t, PivotArenaAllocator<vdb_udf::int_t> > positions(m_add_positions.get_allocator());
+
+        for (uint32_t e = 0; e < order.size(); e++)
+            order[e] = e;
+        std::sort(order.begin(), order.end(), AddedLess(this));
+
+        positions.reserve(order.size());
+        for (std::size_t i = 0; i < order.size(); i++)
+            positions.push_back(m_add_positions[order[i]]);
+        m_add_positions.swap(positions);
+
+        if (isStringMap())
+        {
+            std::vector<uint32_t, PivotArenaAllocator<uint32_t> > offsets(m_add_offsets.get_allocator());
+            PivotArenaString bytes(m_add_bytes.get_allocator());
+
+            offsets.reserve(m_add_offsets.size());
+            bytes.reserve(m_add_bytes.size());
+            offsets.push_back(0);
+            for (std::size_t i = 0; i < order.size(); i++)
+            {
+                uint32_t start = m_add_offsets[order[i]];
+                bytes.append(m_add_bytes, start, m_add_offsets[order[i] + 1] - start);
+                offsets.push_back((uint32_t) bytes.size());
+            }
+            m_add_offsets.swap(offsets);
+            m_add_bytes.swap(bytes);
+        }
+        else
+        {
+            std::vector<PivotKey, PivotArenaAllocator<PivotKey> > keys(m_add_keys.get_allocator());
+
+            keys.reserve(m_add_keys.size());
+            for (std::size_t i = 0; i < order.size(); i++)
+                keys.push_back(m_add_keys[order[i]]);
+            m_add_keys.swap(keys);
+        }
+    }
+
+    /// Orders added entries by key for sortAdded
+    struct AddedLess
+    {
+        PivotMapTable *m_map;
+        explicit AddedLess(PivotMapTable *map) : m_map(map) {}
+        inline bool operator ()(uint32_t a, uint32_t b) const
+        {
+            PivotMapTable &map = *m_map;
+            if (map.isStringMap())
+            {
+                const char *base = map.m_add_bytes.data();
+                const std::vector<uint32_t, PivotArenaAllocator<uint32_t> > &o = map.m_add_offsets;
+                return compareBytes(base + o[a], o[a + 1] - o[a], base + o[b], o[b + 1] - o[b]) < 0;
+            }
+            return compareKeys(keyClass(map.m_pivotcol_type), map.m_add_keys[a], map.m_add_keys[b]) < 0;
+        }
+    };
+
+    static inline int compareBytes(const char *a, std::size_t alen, const char *b, std::size_t blen)
+    {
+        int c = memcmp(a, b, std::min(alen, blen));
+        if (c != 0)
+            return c;
+        return (alen < blen) ? -1 : (alen > blen);
+    }
+
+    /// Three-way comparison of two non-string keys of a class in value order.  NaN sorts after every float.
+    static inline int compareKeys(vdb_udf::int_t keyclass, const PivotKey &a, const PivotKey &b)
+    {
+        if (keyclass == PivotKeyNumeric)
+        {
+            vdb_udf::numeric_t x = (vdb_udf::numeric_t) (((__uint128_t) a.m_hi << 64) | a.m_lo);
+            vdb_udf::numeric_t y = (vdb_udf::numeric_t) (((__uint128_t) b.m_hi << 64) | b.m_lo);
+            return (x < y) ? -1 : (x > y);
+        }
+        if (keyclass == PivotKeyFloat)
+        {
+            vdb_udf::float8_t x, y;
+            memcpy(&x, &a.m_lo, sizeof(x));
+            memcpy(&y, &b.m_lo, sizeof(y));
+            if (x != x || y != y)
+                return (y != y) - (x != x);
+            return (x < y) ? -1 : (x > y);
+        }
+        return ((vdb_udf::bigint_t) a.m_lo < (vdb_udf::bigint_t) b.m_lo) ? -1 : ((vdb_udf::bigint_t) a.m_lo > (vdb_udf::bigint_t) b.m_lo);
+    }
+
+    static uint64_t blobSize(const PivotMapHeader &header)
+    {
+        uint64_t size = sizeof(PivotMapHeader) + pivotAlign8((uint64_t) header.m_entries * sizeof(vdb_udf::int_t));
+
+        if (header.m_key_count > 1)
+            size += (uint64_t) header.m_entries * header.m_key_count * sizeof(PivotKey) + pivotAlign8(header.m_key_bytes);
+        else if (keyClass(header.m_pivotcol_type) == PivotKeyString)
+            size += pivotAlign8(((uint64_t) header.m_entries + 1) * sizeof(uint32_t)) + pivotAlign8(header.m_key_bytes);
+        else
+            size += (uint64_t) header.m_entries * sizeof(PivotKey);
+
+        size += pivotAlign8((uint64_t) header.m_index_size * sizeof(uint32_t));
+        if (header.m_lookup_mode == PivotLookupPerfect)
+            size += pivotAlign8((uint64_t) header.m_entries * sizeof(uint32_t));
+        else if (header.m_lookup_mode == PivotLookupHash)
+            size += pivotAlign8((uint64_t) header.m_index_size + PIVOT_GROUP_WIDTH - 1);
+        return size;
+    }
+
+    /// Point the section pointers into the blob according to its header
+    void layout()
+    {
+        char *base = &m_blob[0];
+        const PivotMapHeader *header = (const PivotMapHeader *) base;
+        uint64_t pos = sizeof(PivotMapHeader);
+
+        m_pivotcol_type = header->m_pivotcol_type;
+        m_pivotcol_len = header->m_pivotcol_len;
+        m_pivotcol_scale = header->m_pivotcol_scale;
+        m_value_type = header->m_value_type;
+        m_value_len = header->m_value_len;
+        m_lookup_mode = header->m_lookup_mode;
+        m_entries = header->m_entries;
+        m_slots = header->m_slots;
+        m_index_size = header->m_index_size;
+        m_dense_min = header->m_dense_min;
+        m_key_count = header->m_key_count;
+        memcpy(m_key_types, header->m_key_types, sizeof(m_key_types));
+        memcpy(m_key_scales, header->m_key_scales, sizeof(m_key_scales));
+
+        m_positions = (vdb_udf::int_t *) (base + pos);
+        pos += pivotAlign8((uint64_t) m_entries * sizeof(vdb_udf::int_t));
+        m_keys = NULL;
+        m_key_offsets = NULL;
+        m_key_bytes = NULL;
+        if (isStringMap())
+        {
+            m_key_offsets = (uint32_t *) (base + pos);
+            pos += pivotAlign8(((uint64_t) m_entries + 1) * sizeof(uint32_t));
+            m_key_bytes = base + pos;
+            pos += pivotAlign8(header->m_key_bytes);
+        }
+        else
+        {
+            m_keys = (PivotKey *) (base + pos);
+            pos += (uint64_t) m_entries * m_key_count * sizeof(PivotKey);
+            if (isComposite())
+            {
+                m_key_bytes = base + pos;
+                pos += pivotAlign8(header->m_key_bytes);
+            }
+        }
+
+        m_index = (uint32_t *) (base + pos);
+        m_dense = (vdb_udf::int_t *) (base + pos);
+        pos += pivotAlign8(m_index_size * sizeof(uint32_t));
+        m_perfect_entries = (uint32_t *) (base + pos);
+        m_ctrl = (uint8_t *) (base + pos);
+    }
+
+    /// Validate a received blob and point into it.  m_valid stays false if the blob is damaged or was
+    /// written by a different version.
+    void attach()
+    {
+        const PivotMapHeader *header = (const PivotMapHeader *) m_blob.data();
+
+        m_valid = false;
+        if (m_blob.size() < sizeof(PivotMapHeader) ||
+            header->m_magic != PIVOT_MAP_MAGIC ||
+            header->m_version != PIVOT_MAP_VERSION ||
+            header->m_key_count < 1 || header->m_key_count > PIVOT_MAX_KEY_COLS ||
+            blobSize(*header) != m_blob.size())
+        {
+            return;
+        }
+        layout();
+        if (checksum() != header->m_checksum)
+            return;
+        if (isStringMap() && (m_key_offsets[0] != 0 || m_key_offsets[m_entries] != header->m_key_bytes))
+            return;
+        m_valid = true;
+    }
+
+    uint64_t checksum()
+    {
+        const char *p = m_blob.data() + sizeof(PivotMapHeader);
+        uint64_t words = (m_blob.size() - sizeof(PivotMapHeader)) / 8;
+        uint64_t h = PIVOT_MAP_MAGIC;
+        uint64_t w;
+
+        for (uint64_t i = 0; i < words; i++)
+        {
+            memcpy(&w, p + i * 8, 8);
+            h = pivotMix64(h ^ w) + i;
+        }
+        return h;
+    }
+
+    inline vdb_udf::bool_t isValid() { return m_valid; }
+
+    vdb_udf::bool_t denseFits(vdb_udf::bigint_t &kmin, uint32_t &span)
+    {
+        vdb_udf::bigint_t kmax;
+
+        if (isComposite() || keyClass(m_pivotcol_type) != PivotKeyInteger || m_add_keys.empty())
+            return false;
+
+        kmin = std::numeric_limits<vdb_udf::bigint_t>::max();
+        kmax = std::numeric_limits<vdb_udf::bigint_t>::min();
+        for (std::size_t i = 0; i < m_add_keys.size(); i++)
+        {
+            vdb_udf::bigint_t k = (vdb_udf::bigint_t) m_add_keys[i].m_lo;
+            if (k < kmin)
+                kmin = k;
+            if (k > kmax)
+                kmax = k;
+        }
+
+        // Compare as unsigned so that spans wider than 63 bits cannot wrap negative
+        uint64_t width = (uint64_t) kmax - (uint64_t) kmin + 1;
+        if (width <= PIVOT_DENSE_MAX_SPAN &&
+            (width <= PIVOT_DENSE_MIN_SPAN || width <= (uint64_t) m_add_keys.size() * PIVOT_DENSE_FILL))
+        {
+            span = (uint32_t) width;
+            return true;
+        }
+        return false;
+    }
+
+    /// Hash of the key of an entry; before the freeze it reads the add arrays, afterwards the blob
+    inline uint64_t entryHash(uint32_t e)
+    {
+        if (isComposite())
+        {
+            if (m_keys != NULL)
+                return compositeHash(m_keys + (std::size_t) e * m_key_count, m_key_bytes);
+            return compositeHash(&m_add_keys[(std::size_t) e * m_key_count], m_add_bytes.data());
+        }
+        if (isStringMap())
+        {
+            if (m_key_offsets != NULL)
+                return pivotHashBytes(m_key_bytes + m_key_offsets[e], m_key_offsets[e + 1] - m_key_offsets[e]);
+            return pivotHashBytes(m_add_bytes.data() + m_add_offsets[e], m_add_offsets[e + 1] - m_add_offsets[e]);
+        }
+        return PivotKeyHash()(m_keys != NULL ? m_keys[e] : m_add_keys[e]);
+    }
+
+    static inline uint64_t perfectSlot(uint64_t h, uint32_t seed, uint64_t nslots)
+    {
+        // Buckets with a single key store their slot directly instead of a seed
+        if (seed & PIVOT_PERFECT_DIRECT)
+            return seed & ~PIVOT_PERFECT_DIRECT;
+        return pivotRange(pivotMix64(h ^ ((uint64_t) seed * 0x9e3779b97f4a7c15ULL)), nslots);
+    }
+
+    /// Hash and displace: place the largest buckets first, searching for a seed that lands every key of
+    /// the bucket on a free slot.  Returns false if some bucket cannot be placed (e.g. two keys share a
+    /// 64-bit hash).
+    vdb_udf::bool_t searchPerfectSeeds(std::vector<uint32_t> &seeds)
+    {
+        uint64_t nslots = m_add_positions.size();
+        uint64_t nbuckets = nslots / PIVOT_PERFECT_BUCKET_KEYS + 1;
+        std::vector<uint64_t> hashes(nslots);
+
+        for (uint64_t i = 0; i < nslots; i++)
+            hashes[i] = entryHash((uint32_t) i);
+
+        // Counting sort of the keys by bucket, then of the buckets by descending size
+        std::vector<uint32_t> bucket_start(nbuckets + 1, 0);
+        std::vector<uint64_t> by_bucket(nslots);
+        for (uint64_t i = 0; i < nslots; i++)
+            bucket_start[pivotRange(hashes[i], nbuckets) + 1]++;
+        for (uint64_t b = 0; b < nbuckets; b++)
+            bucket_start[b + 1] += bucket_start[b];
+        std::vector<uint32_t> fill(bucket_start.begin(), bucket_start.end() - 1);
+        for (uint64_t i = 0; i < nslots; i++)
+            by_bucket[fill[pivotRange(hashes[i], nbuckets)]++] = hashes[i];
+
+        uint32_t maxsize = 0;
+        for (uint64_t b = 0; b < nbuckets; b++)
+            maxsize = std::max(maxsize, bucket_start[b + 1] - bucket_start[b]);
+        std::vector<std::vector<uint32_t> > by_size(maxsize + 1);
+        for (uint64_t b = 0; b < nbuckets; b++)
+            by_size[bucket_start[b + 1] - bucket_start[b]].push_back((uint32_t) b);
+
+        std::vector<char> taken(nslots, 0);
+        std::vector<uint64_t> placed;
+        uint64_t next_free = 0;
+        seeds.assign(nbuckets, 0);
+
+        for (uint32_t size = maxsize; size > 0; size--)
+        {
+            for (std::size_t i = 0; i < by_size[size].size(); i++)
+            {
+                uint32_t b = by_size[size][i];
+                uint32_t first = bucket_start[b];
+
+                if (size == 1)
+                {
+                    while (taken[next_free])
+                        next_free++;
+                    taken[next_free] = 1;
+                    seeds[b] = PIVOT_PERFECT_DIRECT | (uint32_t) next_free;
+                    continue;
+                }
+
+                uint32_t seed;
+                for (seed = 0; seed < PIVOT_PERFECT_MAX_SEEDS; seed++)
+                {
+                    placed.clear();
+                    uint32_t k;
+                    for (k = 0; k < size; k++)
+                    {
+                        uint64_t slot = perfectSlot(by_bucket[first + k], seed, nslots);
+                        if (taken[slot])
+                            break;
+                        taken[slot] = 1;
+                        placed.push_back(slot);
+                    }
+                    if (k == size)
+                        break;
+                    for (std::size_t u = 0; u < placed.size(); u++)
+                        taken[placed[u]] = 0;
+                }
+                if (seed == PIVOT_PERFECT_MAX_SEEDS)
+                    return false;
+                seeds[b] = seed;
+            }
+        }
+        return true;
+    }
+
+    /// Write the key of entry e into an output column of the map's key type
+    void writeKey(vdb_udf::RowDesc *row_p, vdb_udf::ColumnIndex col, uint32_t e)
+    {
+        vdb_udf::float8_t myfloat8;
+
+        if (isStringMap())
+        {
+            const char *key = m_key_bytes + m_key_offsets[e];
+            vdb_udf::int_t len = m_key_offsets[e + 1] - m_key_offsets[e];
+            if (m_pivotcol_type == vdb_udf::TypeBpChar)
+                row_p->setBpChar(col, key, len);
+            else
+                row_p->setVarChar(col, key, len);
+            return;
+        }
+
+        const PivotKey &key = m_keys[e];
+        switch (m_pivotcol_type)
+        {
+            case vdb_udf::TypeTimeStamp:
+                row_p->setTimeStamp(col, (vdb_udf::timestamp_t) key.m_lo);
+                break;
+            case vdb_udf::TypeBigInt:
+                row_p->setBigInt(col, (vdb_udf::bigint_t) key.m_lo);
+                break;
+            case vdb_udf::TypeNumeric:
+                row_p->setNumeric(col, (vdb_udf::numeric_t) (((__uint128_t) key.m_hi << 64) | key.m_lo));
+                break;
+            case vdb_udf::TypeInt:
+                row_p->setInt(col, (vdb_udf::int_t) key.m_lo);
+                break;
+            case vdb_udf::TypeDate:
+                row_p->setDate(col, (vdb_udf::date_t) key.m_lo);
+                break;
+            case vdb_udf::TypeSmallInt:
+                row_p->setSmallInt(col, (vdb_udf::smallint_t) key.m_lo);
+                break;
+            case vdb_udf::TypeFloat4:
+                memcpy(&myfloat8, &key.m_lo, sizeof(myfloat8));
+                row_p->setFloat4(col, (vdb_udf::float4_t) myfloat8);
+                break;
+            case vdb_udf::TypeFloat8:
+                memcpy(&myfloat8, &key.m_lo, sizeof(myfloat8));
+                row_p->setFloat8(col, myfloat8);
+                break;
+            default:
+                row_p->setNull(col, true);
+                break;
+        }
+    }
+
+    /// Bit i of the result is set if control byte pos + i holds tag; bit i of empty if that slot is empty
+    inline uint32_t groupMatch(uint64_t pos, uint8_t tag, uint32_t &empty)
+    {
+#if defined(__SSE2__)
+        __m128i group = _mm_loadu_si128((const __m128i *) (m_ctrl + pos));
+        empty = (uint32_t) _mm_movemask_epi8(group);
+        return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) tag)));
+#else
+        uint32_t match = 0;
+        empty = 0;
+        for (int i = 0; i < PIVOT_GROUP_WIDTH; i++)
+        {
+            if (m_ctrl[pos + i] == tag)
+                match |= 1U << i;
+            else if (m_ctrl[pos + i] & PIVOT_CTRL_EMPTY)
+                empty |= 1U << i;
+        }
+        return match;
+#endif
+    }
+
+    inline vdb_udf::bool_t stringMatch(uint32_t e, const char *key, std::size_t len)
+    {
+        uint32_t start = m_key_offsets[e];
+        return m_key_offsets[e + 1] - start == len && memcmp(m_key_bytes + start, key, len) == 0;
+    }
+
+    /// Sorted mode: compare entry e with key, which for a string map is a probe (see componentBytes)
+    inline int compareEntry(uint32_t e, const PivotKey &key)
+    {
+        if (m_key_offsets != NULL)
+            return compareBytes(m_key_bytes + m_key_offsets[e], m_key_offsets[e + 1] - m_key_offsets[e],
+                (const char *) (uintptr_t) key.m_lo, (std::size_t) key.m_hi);
+        return compareKeys(keyClass(m_pivotcol_type), m_keys[e], key);
+    }
+
+    /// Sorted mode: the first entry not less than key.  The search gallops forward from cursor, so walking keys in
+    /// ascending order costs amortized O(1) per key; a key behind the cursor is searched for from the start.
+    inline uint32_t seekSorted(const PivotKey &key, uint32_t cursor)
+    {
+        uint32_t lo = std::min(cursor, m_entries);
+        uint32_t hi = lo;
+        uint32_t step = 1;
+
+        if (lo > 0 && compareEntry(lo - 1, key) >= 0)
+        {
+            hi = lo;
+            lo = 0;
+        }
+        else
+        {
+            // Everything before lo is less than key; stop at the first probe that is not
+            while (hi < m_entries && compareEntry(hi, key) < 0)
+            {
+                lo = hi + 1;
+                hi = (m_entries - lo > step) ? lo + step : m_entries;
+                step <<= 1;
+            }
+        }
+        while (lo < hi)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (compareEntry(mid, key) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    /// Sorted mode lookup that moves cursor to the key's place.  key is a probe for a string map.
+    inline vdb_udf::int_t findcolumnoffset(const PivotKey &key, uint32_t &cursor)
+    {
+        cursor = seekSorted(key, cursor);
+        return (cursor < m_entries && compareEntry(cursor, key) == 0) ? m_positions[cursor] : -1;
+    }
+
+    inline vdb_udf::int_t findcolumnoffset(const PivotKey &key)
+    {
+        if (m_lookup_mode == PivotLookupSorted)
+        {
+            uint32_t cursor = 0;
+            return findcolumnoffset(key, cursor);
+        }
+        if (m_lookup_mode == PivotLookupDense)
+        {
+            // One bounds check covers keys on either side of the range
+            uint64_t slot = key.m_lo - (uint64_t) m_dense_min;
+            return (slot < m_index_size) ? m_dense[slot] : -1;
+        }
+
+        uint64_t h = PivotKeyHash()(key);
+        if (m_lookup_mode == PivotLookupPerfect)
+        {
+            uint32_t e = m_perfect_entries[perfectSlot(h, m_index[pivotRange(h, m_index_size)], m_entries)];
+            return (m_keys[e] == key) ? m_positions[e] : -1;
+        }
+
+        // Set to null if no match found
+        for (uint64_t pos = (h >> 7) & (m_index_size - 1); ; pos = (pos + PIVOT_GROUP_WIDTH) & (m_index_size - 1))
+        {
+            uint32_t empty;
+            for (uint32_t match = groupMatch(pos, (uint8_t) (h & 0x7f), empty); match != 0; match &= match - 1)
+            {
+                uint32_t e = m_index[(pos + __builtin_ctz(match)) & (m_index_size - 1)] - 1;
+                if (m_keys[e] == key)
+                    return m_positions[e];
+            }
+            if (empty != 0)
+                return(-1);
+        }
+    }
+
+    inline vdb_udf::int_t findcolumnoffset(const char *key, std::size_t len)
+    {
+        if (m_lookup_mode == PivotLookupSorted)
+        {
+            PivotKey probe;
+            uint32_t cursor = 0;
+            probe.m_lo = (uint64_t) (uintptr_t) key;
+            probe.m_hi = len;
+            return findcolumnoffset(probe, cursor);
+        }
+
+        uint64_t h = pivotHashBytes(key, len);
+        if (m_lookup_mode == PivotLookupPerfect)
+        {
+            uint32_t e = m_perfect_entries[perfectSlot(h, m_index[pivotRange(h, m_index_size)], m_entries)];
+            return stringMatch(e, key, len) ? m_positions[e] : -1;
+        }
+
+        for (uint64_t pos = (h >> 7) & (m_index_size - 1); ; pos = (pos + PIVOT_GROUP_WIDTH) & (m_index_size - 1))
+        {
+            uint32_t empty;
+            for (uint32_t match = groupMatch(pos, (uint8_t) (h & 0x7f), empty); match != 0; match &= match - 1)
+            {
+                uint32_t e = m_index[(pos + __builtin_ctz(match)) & (m_index_size - 1)] - 1;
+                if (stringMatch(e, key, len))
+                    return m_positions[e];
+            }
+            if (empty != 0)
+                return(-1);
+        }
+    }
+
+    /// Look up a composite key given as m_key_count probe components (see componentBytes)
+    inline vdb_udf::int_t findcolumnoffset(const PivotKey *keys)
+    {
+        uint64_t h = compositeHash(keys, NULL);
+        if (m_lookup_mode == PivotLookupPerfect)
+        {
+            uint32_t e = m_perfect_entries[perfectSlot(h, m_index[pivotRange(h, m_index_size)], m_entries)];
+            return compositeMatch(m_keys + (std::size_t) e * m_key_count, m_key_bytes, keys, NULL) ? m_positions[e] : -1;
+        }
+
+        for (uint64_t pos = (h >> 7) & (m_index_size - 1); ; pos = (pos + PIVOT_GROUP_WIDTH) & (m_index_size - 1))
+        {
+            uint32_t empty;
+            for (uint32_t match = groupMatch(pos, (uint8_t) (h & 0x7f), empty); match != 0; match &= match - 1)
+            {
+                uint32_t e = m_index[(pos + __builtin_ctz(match)) & (m_index_size - 1)] - 1;
+                if (compositeMatch(m_keys + (std::size_t) e * m_key_count, m_key_bytes, keys, NULL))
+                    return m_positions[e];
+            }
+            if (empty != 0)
+                return(-1);
+        }
+    }
+
+    inline vdb_udf::int_t findcolumnoffset(const std::string &key)
+    {
+        return findcolumnoffset(key.data(), key.size());
+    }
+
+    inline vdb_udf::int_t keyCol() {return m_key_col_idx;}
+    inline void setKeyCol(vdb_udf::int_t idx) {m_key_col_idx = idx;}
+    inline std::size_t getMapSize() { return m_valid ? m_entries : m_add_positions.size(); }
+    /// Column positions, one per COLUMN_LIST row; more than getMapSize() when a key repeats
+    inline std::size_t getSlotCount() { return m_valid ? m_slots : m_add_slots; }
+    inline vdb_udf::int_t getPivotValType() { return m_value_type; }
+    inline vdb_udf::int_t getPivotValLen()  { return m_value_len; }
+    inline vdb_udf::int_t getPivotColType() { return m_pivotcol_type; }
+    inline vdb_udf::int_t getPivotColScale() { return m_pivotcol_scale; }
+    inline vdb_udf::int_t getKeyCount() { return m_key_count; }
+    inline vdb_udf::int_t getLookupMode() { return m_lookup_mode; }
+    inline vdb_udf::int_t getKeyType(vdb_udf::int_t k) { return m_key_types[k]; }
+    inline vdb_udf::int_t getKeyScale(vdb_udf::int_t k) { return m_key_scales[k]; }
+
+    PivotMapTable(PivotArena &arena) :
+        m_arena(arena),
+        m_add_seen(0, PivotKeyHash(), std::equal_to<PivotKey>(), PivotArenaAllocator<PivotKey>(arena)),
+        m_add_seen_strings(0, PivotArenaStringHash(), std::equal_to<PivotArenaString>(), PivotArenaAllocator<PivotArenaString>(arena)),
+        m_add_seen_composite(0, CompositeEntryHash(this), CompositeEntryEqual(this), PivotArenaAllocator<uint32_t>(arena)),
+        m_add_keys(PivotArenaAllocator<PivotKey>(arena)),
+        m_add_offsets(PivotArenaAllocator<uint32_t>(arena)),
+        m_add_bytes(PivotArenaAllocator<char>(arena)),
+        m_add_positions(PivotArenaAllocator<vdb_udf::int_t>(arena))
+    {
+        m_key_col_idx = 0;
+        m_value_type = 0;    
+        m_value_len = 0;
+		m_pivotcol_type = 0;
+		m_pivotcol_len = 0;
+		m_pivotcol_scale = 0;
+        m_key_count = 1;
+        memset(m_key_types, 0, sizeof(m_key_types));
+        memset(m_key_scales, 0, sizeof(m_key_scales));
+        m_lookup_mode = PivotLookupHash;
+        m_valid = false;
+        m_add_slots = 0;
+        m_entries = 0;
+        m_slots = 0;
+        m_index_size = 0;
+        m_dense_min = 0;
+        m_positions = NULL;
+        m_keys = NULL;
+        m_key_offsets = NULL;
+        m_key_bytes = NULL;
+        m_index = NULL;
+        m_perfect_entries = NULL;
+        m_ctrl = NULL;
+        m_dense = NULL;
+    }
+
+    ~PivotMapTable()
+    {
+    }
+
+private:
+    // The section pointers refer to m_blob, so a copy would alias another map's buffer
+    PivotMapTable(const PivotMapTable &);
+    PivotMapTable &operator =(const PivotMapTable &);
+};
+
+
+/// The frozen map received as session data, shared by all functors in the process that receive the same map.
+///
+/// Rather than every functor deserializing a private copy, the first one reads the blob and the others take a
+/// reference to its map, found by the size and identity that precede the blob.  The map is immutable once frozen,
+/// and it is freed with the last functor that refers to it.
+class PivotSharedMap : public vdb_udf::SessionObject
+{
+public:
+    /// The map in the session data of arg.  The blob is only read if no live functor holds the map already.
+    static std::shared_ptr<PivotMapTable> acquire(vdb_udf::TableArg &arg)
+    {
+        PivotSharedMap handle;
+
+        arg.getSessionData(handle);
+        return handle.m_map;
+    }
+
+    /// Start serializes the PivotMapTable itself
+    void serialize(vdb_udf::Serializer &/*s*/)
+    {
+    }
+
+    void deserialize(vdb_udf::Serializer &s)
+    {
+        vdb_udf::int_t size, idLo, idHi;
+
+        s >> size;
+        s >> idLo;
+        s >> idHi;
+
+        Registry &maps = registry();
+        Registry::key_type key(((uint64_t) (uint32_t) idHi << 32) | (uint32_t) idLo, size);
+
+        {
+            std::lock_guard<std::mutex> lock(registryMutex());
+            Registry::iterator it = maps.find(key);
+            if (it != maps.end() && (m_map = it->second.lock()))
+                return;
+        }
+
+        // A map is a few pointers into its blob, so it lives in one allocation with the arena it was built with.
+        // The blob is read outside the lock; functors that miss at the same time each read a copy and the last one
+        // read is registered.
+        std::shared_ptr<Entry> entry(new Entry());
+        entry->m_map.readBlob(s);
+        m_map = std::shared_ptr<PivotMapTable>(entry, &entry->m_map);
+
+        std::lock_guard<std::mutex> lock(registryMutex());
+        for (Registry::iterator it = maps.begin(); it != maps.end(); )
+        {
+            if (it->second.expired())
+                maps.erase(it++);
+            else
+                ++it;
+        }
+        if (m_map->isValid())
+            maps[key] = m_map;
+    }
+
+private:
+    struct Entry
+    {
+        PivotArena m_arena;
+        PivotMapTable m_map;
+
+        Entry() : m_map(m_arena)
+        {
+        }
+    };
+
+    typedef std::map<std::pair<uint64_t, vdb_udf::int_t>, std::weak_ptr<PivotMapTable> > Registry;
+
+    // Functors of many partitions deserialize at the same time, so the registry is only touched under this lock
+    static std::mutex &registryMutex()
+    {
+        static std::mutex lock;
+        return lock;
+    }
+
+    static Registry &registry()
+    {
+        static Registry maps;
+        return maps;
+    }
+
+    std::shared_ptr<PivotMapTable> m_map;
+};
+
+
+/// The result of a COLUMN_LIST query: the column descriptions, the text of every column after the key columns, and
+/// the key map built from the key columns and frozen in the requested lookup mode.
+///
+/// Results are kept in the process so that the query runs once per statement rather than once in Describe and again
+/// in Start.  Without a version, Describe always runs the query and hands its result to the Start of the same
+/// statement.  The SDK gives Describe no way to pass a value to Start, so a handoff is keyed by the query, and a
+/// handoff may be one that a concurrent statement, or one whose Start never came, left under the same query.
+/// Start therefore takes a handoff only if it alone fits the output columns Describe laid out; otherwise it runs the
+/// query again and raises an error only when the result no longer fits them.  With a version, the result is kept for
+/// later statements that pass the same query text and version.  The cache is shared by all commands in the process
+/// and is guarded by a mutex; entries are immutable once stored.
+class PivotColumnList
+{
+public:
+    struct ColumnDesc
+    {
+        vdb_udf::int_t type;
+        vdb_udf::int_t length;
+        vdb_udf::int_t precision;
+        vdb_udf::int_t scale;
+        std::string name;
+
+        bool operator ==(const ColumnDesc &other) const
+        {
+            return type == other.type && length == other.length && precision == other.precision &&
+                   scale == other.scale && name == other.name;
+        }
+    };
+
+    typedef std::shared_ptr<const PivotColumnList> Ptr;
+    /// Whether a result gives the output columns that Describe laid out for the statement
+    typedef std::function<vdb_udf::bool_t (const PivotColumnList &)> Fits;
+
+    std::vector<ColumnDesc> m_columns;
+    std::vector<std::string> m_labels;
+    vdb_udf::int_t m_key_count;
+    vdb_udf::int_t m_rows;
+    vdb_udf::int_t m_distinct_keys;
+    std::string m_blob;
+
+    /// Text of the col-th column after the key columns in row row
+    inline const std::string &label(vdb_udf::int_t row, vdb_udf::int_t col) const
+    {
+        return m_labels[(std::size_t) row * (m_columns.size() - m_key_count) + col];
+    }
+
+    /// Return the result of query for Describe: a versioned result is reused, otherwise the query runs
+    static Ptr get(vdb_udf::TableArg &arg, const std::string &query, const std::string &version,
+                   vdb_udf::int_t lookupMode, vdb_udf::int_t keyCount)
+    {
+        std::string key = cacheKey(query, version, lookupMode, keyCount);
+
+        if (!version.empty())
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            Ptr found = use(key);
+            if (found)
+                return found;
+        }
+
+        // The query runs outside the lock; a versioned result stored meanwhile by another statement wins
+        std::shared_ptr<PivotColumnList> list(new PivotColumnList());
+        list->run(arg, query.c_str(), lookupMode, keyCount);
+        if (version.empty())
+            return list;
+
+        std::lock_guard<std::mutex> lock(mutex());
+        Ptr found = use(key);
+        if (found)
+            return found;
+        store(key, list);
+        return list;
+    }
+
+    /// Return the result of query for Start: the versioned result or the one handoff that fits the output columns
+    /// of the statement.  With none or several, the query runs again and its result must fit them.
+    static Ptr take(vdb_udf::TableArg &arg, const std::string &query, const std::string &version,
+                    vdb_udf::int_t lookupMode, vdb_udf::int_t keyCount, const Fits &fits)
+    {
+        std::string key = cacheKey(query, version, lookupMode, keyCount);
+        std::vector<Ptr> candidates;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            if (!version.empty())
+            {
+                Ptr found = use(key);
+                if (found)
+                    candidates.push_back(found);
+            }
+            else
+            {
+                expireHandoffs(Clock::now());
+                std::pair<Handoffs::iterator, Handoffs::iterator> range = handoffs().equal_range(key);
+                for (Handoffs::iterator it = range.first; it != range.second; ++it)
+                    candidates.push_back(it->second.m_list);
+            }
+        }
+
+        // Results that fit alike, such as the same result handed off by two statements, cannot be told apart
+        // and need not be
+        Ptr found;
+        vdb_udf::bool_t ambiguous = false;
+        for (std::size_t i = 0; i < candidates.size(); i++)
+        {
+            if (!fits(*candidates[i]))
+                continue;
+            if (!found)
+                found = candidates[i];
+            else if (!found->sameResult(*candidates[i]))
+                ambiguous = true;
+        }
+        if (found && !ambiguous)
+        {
+            std::lock_guard<std::mutex> lock(mutex());
+            release(key, found);
+            return found;
+        }
+
+        std::shared_ptr<PivotColumnList> list(new PivotColumnList());
+        list->run(arg, query.c_str(), lookupMode, keyCount);
+        if (!fits(*list))
+        {
+            char emsg[256];
+            snprintf(emsg, 256, "the column description query result changed after Describe; the output columns no longer match it");
+            arg.throwError(__func__, emsg);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex());
+        if (!version.empty())
+        {
+            versioned().erase(key);
+            store(key, list);
+        }
+        else
+        {
+            // Handoffs that differ from the current result are stale; a Start that needed one runs the query too
+            std::pair<Handoffs::iterator, Handoffs::iterator> range = handoffs().equal_range(key);
+            for (Handoffs::iterator it = range.first; it != range.second; )
+            {
+                if (!it->second.m_list->sameResult(*list))
+                    handoffs().erase(it++);
+                else
+                    ++it;
+            }
+            release(key, list);
+        }
+        return list;
+    }
+
+    /// Hand the result Describe laid out its columns from to the Start of the same statement.  Describe calls this
+    /// once the statement is valid, so that a failed Describe leaves nothing behind.
+    static void handOff(const std::string &query, const std::string &version, vdb_udf::int_t lookupMode,
+                        vdb_udf::int_t keyCount, const Ptr &list)
+    {
+        if (!version.empty())
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex());
+        Handoffs &entries = handoffs();
+        Clock::time_point now = Clock::now();
+
+        expireHandoffs(now);
+        if (entries.size() >= PIVOT_COLUMN_LIST_CACHE_MAX)
+        {
+            Handoffs::iterator oldest = entries.begin();
+            for (Handoffs::iterator it = entries.begin(); it != entries.end(); ++it)
+            {
+                if (it->second.m_time < oldest->second.m_time)
+                    oldest = it;
+            }
+            entries.erase(oldest);
+        }
+        Handoff entry = { list, now };
+        entries.insert(std::make_pair(cacheKey(query, version, lookupMode, keyCount), entry));
+    }
+
+    PivotColumnList() : m_key_count(1), m_rows(0), m_distinct_keys(0)
+    {
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    /// A result handed from Describe to Start, one per Describe whose Start has not yet come
+    struct Handoff
+    {
+        Ptr m_list;
+        Clock::time_point m_time;
+    };
+
+    /// A versioned result and the tick of its last use, for evicting the least recently used
+    struct Versioned
+    {
+        Ptr m_list;
+        uint64_t m_used;
+    };
+
+    typedef std::map<std::string, Versioned> VersionedMap;
+    typedef std::multimap<std::string, Handoff> Handoffs;
+
+    static std::mutex &mutex()
+    {
+        static std::mutex lock;
+        return lock;
+    }
+
+    static VersionedMap &versioned()
+    {
+        static VersionedMap entries;
+        return entries;
+    }
+
+    /// Next tick of the versioned results.  Called with the mutex held.
+    static uint64_t tick()
+    {
+        static uint64_t ticks = 0;
+        return ++ticks;
+    }
+
+    /// The versioned result for key, marked as used, or an empty pointer.  Called with the mutex held.
+    static Ptr use(const std::string &key)
+    {
+        VersionedMap::iterator it = versioned().find(key);
+
+        if (it == versioned().end())
+            return Ptr();
+        it->second.m_used = tick();
+        return it->second.m_list;
+    }
+
+    static Handoffs &handoffs()
+    {
+        static Handoffs entries;
+        return entries;
+    }
+
+    /// Keep list as the versioned result for key, which holds none, in place of the least recently used result
+    /// when the cache is full.  Called with the mutex held.
+    static void store(const std::string &key, const Ptr &list)
+    {
+        VersionedMap &entries = versioned();
+
+        if (entries.size() >= PIVOT_COLUMN_LIST_CACHE_MAX)
+        {
+            VersionedMap::iterator oldest = entries.begin();
+            for (VersionedMap::iterator it = entries.begin(); it != entries.end(); ++it)
+            {
+                if (it->second.m_used < oldest->second.m_used)
+                    oldest = it;
+            }
+            entries.erase(oldest);
+        }
+        Versioned entry = { list, tick() };
+        entries.insert(std::make_pair(key, entry));
+    }
+
+    /// Drop one handoff for key with the same result as list, the one of the Describe whose Start takes list.
+    /// Called with the mutex held.
+    static void release(const std::string &key, const Ptr &list)
+    {
+        std::pair<Handoffs::iterator, Handoffs::iterator> range = handoffs().equal_range(key);
+        for (Handoffs::iterator it = range.first; it != range.second; ++it)
+        {
+            if (it->second.m_list->sameResult(*list))
+            {
+                handoffs().erase(it);
+                return;
+            }
+        }
+    }
+
+    /// Drop handoffs whose Start never came, such as those of statements that failed after Describe.  Called with
+    /// the mutex held.
+    static void expireHandoffs(Clock::time_point now)
+    {
+        Handoffs &entries = handoffs();
+
+        for (Handoffs::iterator it = entries.begin(); it != entries.end(); )
+        {
+            if (now - it->second.m_time > std::chrono::seconds(PIVOT_COLUMN_LIST_HANDOFF_SECS))
+                entries.erase(it++);
+            else
+                ++it;
+        }
+    }
+
+    static std::string cacheKey(const std::string &query, const std::string &version, vdb_udf::int_t lookupMode,
+                                vdb_udf::int_t keyCount)
+    {
+        std::string key(query);
+        key.push_back('\0');
+        key.append(version);
+        key.push_back('\0');
+        key.push_back((char) ('0' + lookupMode));
+        key.push_back((char) ('0' + keyCount));
+        return key;
+    }
+
+    /// Whether other holds the same columns, labels and key map
+    vdb_udf::bool_t sameResult(const PivotColumnList &other) const
+    {
+        return m_rows == other.m_rows && m_key_count == other.m_key_count && m_columns == other.m_columns &&
+               m_labels == other.m_labels && m_blob == other.m_blob;
+    }
+
+    void run(vdb_udf::TableArg &arg, const char *query, vdb_udf::int_t lookupMode, vdb_udf::int_t keyCount)
+    {
+        vdb_udf::SQLClient sql(arg);
+        vdb_udf::RowDesc *rowp;
+        PivotArena arena;
+        PivotMapTable tblMap(arena);
+
+        m_columns.clear();
+        m_labels.clear();
+        m_key_count = keyCount;
+        m_rows = 0;
+        m_distinct_keys = 0;
+        m_blob.clear();
+
+        vdb_udf::Schema &schema = sql.open(query);
+        for (std::size_t i = 0; i < schema.size(); i++)
+        {
+            ColumnDesc desc;
+            desc.type = schema.at(i)->type;
+            desc.length = schema.at(i)->length;
+            desc.precision = schema.at(i)->precision;
+            desc.scale = schema.at(i)->scale;
+            desc.name = schema.at(i)->name;
+            m_columns.push_back(desc);
+        }
+
+        // Key columns of the wrong type or number are reported by the callers; there is just no map to build
+        vdb_udf::bool_t keyed = (m_columns.size() >= (std::size_t) keyCount);
+        vdb_udf::int_t types[PIVOT_MAX_KEY_COLS];
+        vdb_udf::int_t scales[PIVOT_MAX_KEY_COLS];
+        for (vdb_udf::int_t k = 0; keyed && k < keyCount; k++)
+        {
+            keyed = (PivotMapTable::keyClass(m_columns[k].type) != PivotKeyNone);
+            types[k] = m_columns[k].type;
+            scales[k] = m_columns[k].scale;
+        }
+        if (!keyed)
+            m_key_count = std::min((std::size_t) keyCount, m_columns.size());
+        else if (keyCount > 1)
+            tblMap.setCompositeKey(keyCount, types, scales);
+        else
+            tblMap.setPivotColType(m_columns[0].type, m_columns[0].length, m_columns[0].scale);
+
+        while ( (rowp = sql.fetch()) != NULL )
+        {
+            for (std::size_t col = m_key_count; col < m_columns.size(); col++)
+            {
+                m_labels.push_back(std::string());
+                rowp->getValueAsString(col, m_labels.back());
+            }
+            if (keyed)
+                tblMap.add(rowp, m_rows);
+            m_rows++;
+        }
+
+        sql.close();
+
+        if (keyed)
+        {
+            m_distinct_keys = tblMap.getMapSize();
+            tblMap.chooseLookup(lookupMode);
+            m_blob = tblMap.getBlob();
+        }
+    }
+};
+
+/// Phases of a two-phase pivot.  PivotPhaseSingle is the ordinary one-pass pivot.
+enum PivotPhase
+{
+    PivotPhaseSingle = 0,
+    PivotPhasePartial,
+    PivotPhaseMerge
+};
+
+/// How a PIVOTCOL value is bucketed before the lookup.  PivotBucketInterval rounds a timestamp down to a multiple of
+/// a fixed interval from a base; PivotBucketMonth maps a date or timestamp to the last day of its month.
+enum PivotBucket
+{
+    PivotBucketNone = 0,
+    PivotBucketInterval,
+    PivotBucketMonth
+};
+
+/// Aggregates a PIVOTVAL column can be folded with.  PivotAggNone keeps the last value that landed in the cell.
+enum PivotAggregateOp
+{
+    PivotAggNone = 0,
+    PivotAggSum,
+    PivotAggCount,
+    PivotAggMin,
+    PivotAggMax,
+    PivotAggAvg
+};
+
+/// Running state of one aggregated pivot cell.  Integer, date and timestamp values accumulate in m_int, float
+/// values in m_float and numeric values in m_numeric.  m_count counts the non-NULL values, m_rows the rows that
+/// landed in the cell.
+struct PivotAccumulator
+{
+    union
+    {
+        vdb_udf::numeric_t m_numeric;
+        vdb_udf::bigint_t m_int;
+        vdb_udf::float8_t m_float;
+    };
+    vdb_udf::bigint_t m_count;
+    vdb_udf::bigint_t m_rows;
+};
+
+/// How process() fills a pivot cell.  Fixed width types are copied through their typed accessors, anything else
+/// through the generic column copy.
+enum PivotCellKind
+{
+    PivotCellCopy = 0,
+    PivotCellInt,
+    PivotCellBigInt,
+    PivotCellSmallInt,
+    PivotCellDate,
+    PivotCellTimeStamp,
+    PivotCellFloat4,
+    PivotCellFloat8,
+    PivotCellNumeric,
+    PivotCellAggregate,
+    PivotCellPacked
+};
+
+/// Where one PIVOTVAL column of one key lands: the input column to read, the output column and cell to write,
+/// and how to fill it.
+struct PivotCellTarget
+{
+    vdb_udf::ColumnIndex m_in;
+    vdb_udf::ColumnIndex m_out;
+    uint32_t m_cell;
+    vdb_udf::int_t m_valcol;
+    vdb_udf::int_t m_kind;
+};
+
+template <vdb_udf::int_t KeyType, vdb_udf::int_t ValueKind> class PivotClassFor;
+
+class PivotClass : public vdb_udf::TableFunction
+{
+    template <vdb_udf::int_t KeyType, vdb_udf::int_t ValueKind> friend class PivotClassFor;
+
+    // Declared first so that it outlives everything allocated from it
+    PivotArena                   m_arena;
+    std::shared_ptr<PivotMapTable> m_shared_map;
+    PivotMapTable                &m_map;
+    typedef std::vector<vdb_udf::ColumnIndex, PivotArenaAllocator<vdb_udf::ColumnIndex> > ColumnIndexVector;
+    typedef std::vector<vdb_udf::Column *, PivotArenaAllocator<vdb_udf::Column *> > ColumnVector;
+    typedef ColumnVector::iterator ColumnVectorIterator;
+    typedef std::vector<vdb_udf::int_t, PivotArenaAllocator<vdb_udf::int_t> > IntVector;
+
+    /// Named parameter values.  The vectors draw from the arena given at construction; copy assignment
+    /// keeps the target's arena.
+    struct PivotParameters
+    {
+		ColumnIndexVector grpCols;
+		IntVector grpColTypes;
+		// The first PIVOTCOL column is also kept apart for the single column key paths
+		ColumnIndexVector pivotCols;
+		IntVector pivotColTypes;
+		IntVector pivotColScales;
+		vdb_udf::ColumnIndex pivotColIdx;
+		vdb_udf::int_t pivotColType;
+		vdb_udf::int_t pivotColScale;
+		ColumnIndexVector pivotValCols;
+		vdb_udf::int_t numpivotValCols;
+		PivotArenaString collistquery;
+		PivotArenaString collistversion;
+		ColumnVector pivotValColDescs;
+		vdb_udf::int_t lookupMode;
+		vdb_udf::bool_t streamGroups;
+		IntVector aggregates;
+		vdb_udf::bool_t aggregating;
+		vdb_udf::int_t phase;
+		vdb_udf::int_t cellWidth;
+		vdb_udf::bool_t packed;
+		vdb_udf::int_t bucket;
+		vdb_udf::bigint_t bucketInterval;
+		vdb_udf::bigint_t bucketBase;
+
+		PivotParameters(PivotArena &arena) :
+			grpCols(PivotArenaAllocator<vdb_udf::ColumnIndex>(arena)),
+			grpColTypes(PivotArenaAllocator<vdb_udf::int_t>(arena)),
+			pivotCols(PivotArenaAllocator<vdb_udf::ColumnIndex>(arena)),
+			pivotColTypes(PivotArenaAllocator<vdb_udf::int_t>(arena)),
+			pivotColScales(PivotArenaAllocator<vdb_udf::int_t>(arena)),
+			pivotColIdx(0),
+			pivotColType(0),
+			pivotColScale(0),
+			pivotValCols(PivotArenaAllocator<vdb_udf::ColumnIndex>(arena)),
+			numpivotValCols(0),
+			collistquery(PivotArenaAllocator<char>(arena)),
+			collistversion(PivotArenaAllocator<char>(arena)),
+			pivotValColDescs(PivotArenaAllocator<vdb_udf::Column *>(arena)),
+			lookupMode(PivotLookupAuto),
+			streamGroups(false),
+			aggregates(PivotArenaAllocator<vdb_udf::int_t>(arena)),
+			aggregating(false),
+			phase(PivotPhaseSingle),
+			cellWidth(1),
+			packed(false),
+			bucket(PivotBucketNone),
+			bucketInterval(0),
+			bucketBase(0)
+		{
+		}
+    };
+
+protected:
+    PivotParameters m_pivotParameters;
+    vdb_udf::bool_t m_first_time;
+    vdb_udf::RowDesc *m_out_rd;
+    vdb_udf::RowStore &m_store;
+    vdb_udf::bool_t m_string_key;
+    // Numeric PIVOTCOL keys are brought to the scale of the COLUMN_LIST keys by one of these factors, per key column
+    vdb_udf::bool_t m_key_rescale;
+    vdb_udf::numeric_t m_key_scale_mul[PIVOT_MAX_KEY_COLS];
+    vdb_udf::numeric_t m_key_scale_div[PIVOT_MAX_KEY_COLS];
+    // Largest magnitude a key can have before multiplying by m_key_scale_mul overflows
+    vdb_udf::numeric_t m_key_scale_limit[PIVOT_MAX_KEY_COLS];
+    // LOOKUP 'sorted': the input is ordered by PIVOTCOL within a group, and m_cursor is where the last key was found
+    vdb_udf::bool_t m_sorted;
+    uint32_t m_cursor;
+    // A multi-column PIVOTCOL is looked up through m_probe, one component per column
+    vdb_udf::bool_t m_composite;
+    PivotKey m_probe[PIVOT_MAX_KEY_COLS];
+    PivotKey m_key;
+    PivotKey m_group_key;
+    std::string m_key_string;
+    std::string m_group_string;
+    std::vector<PivotAccumulator, PivotArenaAllocator<PivotAccumulator> > m_cells;
+    // OUTPUT 'packed': the cells hit by the current group in hit order, and the text of cells kept as input text
+    std::vector<uint32_t, PivotArenaAllocator<uint32_t> > m_touched;
+    std::vector<std::string, PivotArenaAllocator<std::string> > m_cell_text;
+    std::string m_packed;
+    // numpivotValCols targets per key slot, in slot order
+    std::vector<PivotCellTarget, PivotArenaAllocator<PivotCellTarget> > m_targets;
+
+public:  
+    PivotClass(vdb_udf::TableArg &arg, PivotParameters &pivotParameters) : m_shared_map(PivotSharedMap::acquire(arg)), m_map(*m_shared_map), m_pivotParameters(m_arena), m_first_time(true), m_store(arg.getRowStore()),
+        m_cells(PivotArenaAllocator<PivotAccumulator>(m_arena)),
+        m_touched(PivotArenaAllocator<uint32_t>(m_arena)),
+        m_cell_text(PivotArenaAllocator<std::string>(m_arena)),
+        m_targets(PivotArenaAllocator<PivotCellTarget>(m_arena))
+    {
+        m_pivotParameters = pivotParameters;
+        if (!m_map.isValid())
+        {
+            char emsg[256];
+            snprintf(emsg, 256, "pivot key map session data is damaged or from an incompatible version");
+            arg.throwError(__func__, emsg);
+        }
+        // Start checks the key count and labels of the map it builds; only here are the PIVOTCOL types known
+        for (std::size_t k = 0; k < m_pivotParameters.pivotColTypes.size(); k++)
+        {
+            if (k >= (std::size_t) m_map.getKeyCount() ||
+                !PivotMapTable::keyTypesMatch(m_map.getKeyType(k), m_pivotParameters.pivotColTypes[k]))
+            {
+                char emsg[256];
+                snprintf(emsg, 256, "the column description query result changed after Describe; key column %d no longer matches the type of \'%s\' column %d", (int) k, NPV_PIVOTCOL, (int) k);
+                arg.throwError(__func__, emsg);
+            }
+        }
+        // Allocated once nothing above can throw, as the destructor of a half-built functor does not run
+        m_out_rd = m_store.alloc();
+        m_string_key = (PivotMapTable::keyClass(m_pivotParameters.pivotColType) == PivotKeyString);
+        m_composite = (m_pivotParameters.pivotCols.size() > 1);
+        m_sorted = (m_map.getLookupMode() == PivotLookupSorted);
+        m_cursor = 0;
+        m_key_rescale = false;
+        for (std::size_t k = 0; k < m_pivotParameters.pivotColTypes.size() && k < (std::size_t) m_map.getKeyCount(); k++)
+        {
+            m_key_scale_mul[k] = 1;
+            m_key_scale_div[k] = 1;
+            if (PivotMapTable::keyClass(m_pivotParameters.pivotColTypes[k]) != PivotKeyNumeric)
+                continue;
+            for (vdb_udf::int_t i = m_pivotParameters.pivotColScales[k]; i < m_map.getKeyScale(k); i++)
+                m_key_scale_mul[k] *= 10;
+            for (vdb_udf::int_t i = m_map.getKeyScale(k); i < m_pivotParameters.pivotColScales[k]; i++)
+                m_key_scale_div[k] *= 10;
+            m_key_scale_limit[k] = (vdb_udf::numeric_t) (~(__uint128_t) 0 >> 1) / m_key_scale_mul[k];
+            m_key_rescale = m_key_rescale || m_key_scale_mul[k] != 1 || m_key_scale_div[k] != 1;
+        }
+        if (m_pivotParameters.aggregating || m_pivotParameters.phase != PivotPhaseSingle || m_pivotParameters.packed)
+            m_cells.resize(m_map.getSlotCount() * m_pivotParameters.numpivotValCols);
+        if (m_pivotParameters.packed)
+            m_cell_text.resize(m_cells.size());
+        if (m_pivotParameters.phase != PivotPhaseMerge)
+            buildTargets();
+    }
+
+    /// Lay out the cell targets of every key slot so that process() only walks the targets of the slot it found
+    void buildTargets()
+    {
+		vdb_udf::int_t numGrpCols = m_pivotParameters.grpCols.size();
+		vdb_udf::int_t numValCols = m_pivotParameters.numpivotValCols;
+		std::vector<vdb_udf::int_t> kinds(numValCols);
+
+		for (vdb_udf::int_t c_coloffset = 0; c_coloffset < numValCols; c_coloffset++)
+		{
+			if (m_pivotParameters.packed)
+				kinds[c_coloffset] = PivotCellPacked;
+			else if (m_pivotParameters.aggregates[c_coloffset] != PivotAggNone)
+				kinds[c_coloffset] = PivotCellAggregate;
+			else
+				kinds[c_coloffset] = copyKind(m_pivotParameters.pivotValColDescs[c_coloffset]->type);
+		}
+
+		m_targets.resize(m_map.getSlotCount() * numValCols);
+		for (std::size_t cellIdx = 0; cellIdx < m_targets.size(); cellIdx++)
+		{
+			PivotCellTarget &target = m_targets[cellIdx];
+			vdb_udf::int_t c_coloffset = cellIdx % numValCols;
+
+			target.m_in = m_pivotParameters.pivotValCols[c_coloffset];
+			target.m_out = numGrpCols + cellIdx * m_pivotParameters.cellWidth;
+			target.m_cell = (uint32_t) cellIdx;
+			target.m_valcol = c_coloffset;
+			target.m_kind = kinds[c_coloffset];
+		}
+    }
+
+    static vdb_udf::int_t copyKind(vdb_udf::int_t type)
+    {
+		switch (type)
+		{
+			case vdb_udf::TypeInt:
+				return PivotCellInt;
+			case vdb_udf::TypeBigInt:
+				return PivotCellBigInt;
+			case vdb_udf::TypeSmallInt:
+				return PivotCellSmallInt;
+			case vdb_udf::TypeDate:
+				return PivotCellDate;
+			case vdb_udf::TypeTimeStamp:
+				return PivotCellTimeStamp;
+			case vdb_udf::TypeFloat4:
+				return PivotCellFloat4;
+			case vdb_udf::TypeFloat8:
+				return PivotCellFloat8;
+			case vdb_udf::TypeNumeric:
+				return PivotCellNumeric;
+			default:
+				return PivotCellCopy;
+		}
+    }
+
+    ~PivotClass()
+    {
+        m_store.free(m_out_rd);
+    }
+
+    void process(vdb_udf::TableArg &arg, vdb_udf::RowDesc *rd_in)
+    {
+		processAs<0, PivotCellCopy>(arg, rd_in);
+    }
+
+    /// The per-row path.  KeyType is the PIVOTCOL type, or 0 to go by the parameters at run time.  ValueKind is the
+    /// copy kind shared by every PIVOTVAL column, or PivotCellCopy to go by each cell target.
+    template <vdb_udf::int_t KeyType, vdb_udf::int_t ValueKind>
+    inline void processAs(vdb_udf::TableArg &arg, vdb_udf::RowDesc *rd_in)
+    {
+		vdb_udf::int_t myoffset;
+
+		// In streaming mode a change of group key finishes the row being built
+		if (m_pivotParameters.streamGroups && !m_first_time && !sameGroup(rd_in))
+		{
+			flush(arg);
+			m_first_time = true;
+		}
+
+		if (m_first_time)
+			beginGroup(arg, rd_in);
+	
+		if (KeyType == 0 && m_pivotParameters.phase == PivotPhaseMerge)
+		{
+			merge(arg, rd_in);
+			return;
+		}
+
+		if (KeyType == 0)
+			myoffset = findKey(arg, rd_in);
+		else
+			myoffset = findKeyAs<KeyType>(arg, rd_in);
+		if (myoffset < 0)
+			missingKey(arg, rd_in);
+
+		const PivotCellTarget *target = &m_targets[myoffset * m_pivotParameters.numpivotValCols];
+		const PivotCellTarget *end = target + m_pivotParameters.numpivotValCols;
+		for (; target != end; target++)
+		{
+			// Only single phase, non-aggregating functors are specialized on ValueKind, so there is no count to keep
+			if (ValueKind != PivotCellCopy)
+			{
+				copyFixedAs<ValueKind>(target, rd_in);
+				continue;
+			}
+			switch (target->m_kind)
+			{
+				case PivotCellAggregate:
+					if (!accumulate(m_cells[target->m_cell], target->m_valcol, rd_in))
+						sumOverflow(arg, target->m_valcol);
+					continue;
+				case PivotCellPacked:
+					if (!pack(target->m_cell, target->m_valcol, rd_in))
+						sumOverflow(arg, target->m_valcol);
+					continue;
+				case PivotCellCopy:
+					arg.copyColumnValue(rd_in, target->m_in, m_out_rd, target->m_out);
+					break;
+				default:
+					copyFixed(target, rd_in);
+					break;
+			}
+			if (m_pivotParameters.phase == PivotPhasePartial)
+				m_cells[target->m_cell].m_rows++;
+		}
+    }
+
+    /// Write the group columns of the first row of a group and clear the cells
+    void beginGroup(vdb_udf::TableArg &arg, vdb_udf::RowDesc *rd_in)
+    {
+		vdb_udf::ColumnIndex outIdx = 0;
+		vdb_udf::int_t numGrpCols = m_pivotParameters.grpCols.size();
+
+// output the grouping columns
+		for (vdb_udf::int_t grpIdx = 0; grpIdx < numGrpCols; grpIdx++)
+		{
+			int inColIdx = m_pivotParameters.grpCols[grpIdx];
+			arg.copyColumnValue( rd_in, inColIdx, m_out_rd, outIdx);
+			outIdx++;
+		}
+		if (m_pivotParameters.packed)
+		{
+			// Only the cells the last group hit need clearing
+			for (std::size_t i = 0; i < m_touched.size(); i++)
+			{
+				memset(&m_cells[m_touched[i]], 0, sizeof(PivotAccumulator));
+				m_cell_text[m_touched[i]].clear();
+			}
+			m_touched.clear();
+		}
+		else
+		{
+// set all pivoted elements to null initially
+			for (std::size_t j = 0; j < (m_map.getSlotCount() * m_pivotParameters.numpivotValCols * m_pivotParameters.cellWidth); j++)
+			{
+				m_out_rd->setNull(outIdx++, true);
+			}
+			if (!m_cells.empty())
+				memset(&m_cells[0], 0, m_cells.size() * sizeof(PivotAccumulator));
+		}
+		m_cursor = 0;
+		m_first_time = false;
+    }
+
+    /// Column slot of the PIVOTCOL value of rd_in, for any key; -1 if it is not in the map
+    inline vdb_udf::int_t findKey(vdb_udf::TableArg &arg, vdb_udf::RowDesc *rd_in)
+    {
+		if (m_composite)
+			return findComposite(arg, rd_in);
+		if (rd_in->isNull(m_pivotParameters.pivotColIdx))
+			nullKey(arg);
+		if (m_string_key)
+		{
+			std::size_t keylen;
+			const char *key = PivotMapTable::readString(rd_in, m_pivotParameters.pivotColIdx, m_pivotParameters.pivotColType, keylen);
+			return findString(key, keylen);
+		}
+		PivotMapTable::readKey(rd_in, m_pivotParameters.pivotColIdx, m_pivotParameters.pivotColType, m_key);
+		if (m_key_rescale && !rescaleKey(m_key, 0))
+			return -1;
+		if (m_pivotParameters.bucket != PivotBucketNone)
+			bucketKey(m_pivotParameters.pivotColType, m_key);
+		return m_sorted ? m_map.findcolumnoffset(m_key, m_cursor) : m_map.findcolumnoffset(m_key);
+    }
+
+    /// findKey for a single column key of a type known at compile time
+    template <vdb_udf::int_t KeyType>
+    inline vdb_udf::int_t findKeyAs(vdb_udf::TableArg &arg, vdb_udf::RowDesc *rd_in)
+    {
+		if (rd_in->isNull(m_pivotParameters.pivotColIdx))
+			nullKey(arg);
+		if (KeyType == vdb_udf::TypeVarChar || KeyType == vdb_udf::TypeBpChar)
+		{
+			std::size_t keylen;
+			const char *key = PivotMapTable::readString(rd_in, m_pivotParameters.pivotColIdx, KeyType, keylen);
+			return findString(key, keylen);
+		}
+		PivotMapTable::readKeyAs<KeyType>(rd_in, m_pivotParameters.pivotColIdx, m_key);
+		if (KeyType == vdb_udf::TypeNumeric && m_key_rescale && !rescaleKey(m_key, 0))
+			return -1;
+		if ((KeyType == vdb_udf::TypeTimeStamp || KeyType == vdb_udf::TypeDate) && m_pivotParameters.bucket != PivotBucketNone)
+			bucketKey(KeyType, m_key);
+		return m_sorted ? m_map.findcolumnoffset(m_key, m_cursor) : m_map.findcolumnoffset(m_key);
+    }
+
+    inline vdb_udf::int_t findString(const char *key, std::size_t keylen)
+    {
+		if (!m_sorted)
+			return m_map.findcolumnoffset(key, keylen);
+		m_key.m_lo = (uint64_t) (uintptr_t) key;
+		m_key.m_hi = keylen;
+		return m_map.findcolumnoffset(m_key, m_cursor);
+    }
+
+    /// Replace a date or timestamp key by its BUCKET value: a timestamp for an interval, a date for a month
+    inline void bucketKey(vdb_udf::int_t coltype, PivotKey &key)
+    {
+		vdb_udf::bigint_t value = (vdb_udf::bigint_t) key.m_lo;
+
+		if (m_pivotParameters.bucket == PivotBucketInterval)
+		{
+			vdb_udf::bigint_t interval = m_pivotParameters.bucketInterval;
+			vdb_udf::bigint_t base = m_pivotParameters.bucketBase;
+			value = base + calendar::floor_div(value - base, interval) * interval;
+		}
+		else
+		{
+			if (coltype == vdb_udf::TypeTimeStamp)
+				value = calendar::floor_div(value, PIVOT_USECS_PER_DAY);
+			value = pivotMonthEnd(value);
+		}
+		key.m_lo = (uint64_t) value;
+    }
+
+    void nullKey(vdb_udf::TableArg &arg)
+    {
+		char emsg[256];
+		snprintf(emsg, 256, "Cant map NULL pivotcolumn reference");
+		arg.throwError(__func__, emsg);
+    }
+
+    /// Report a 'sum' or 'avg' of PIVOTVAL column c_coloffset that no longer fits its state
+    void sumOverflow(vdb_udf::TableArg &arg, vdb_udf::int_t c_coloffset)
+    {
+		char emsg[256];
+		snprintf(emsg, 256, "sum of \'%s\' column %d overflows %s", NPV_PIVOTVAL, c_coloffset,
+			PivotMapTable::keyClass(m_pivotParameters.pivotValColDescs[c_coloffset]->type) == PivotKeyNumeric ? "numeric(38)" : "bigint");
+		arg.throwError(__func__, emsg);
+    }
+
+    /// Report a PIVOTCOL value of rd_in that is not in the map
+    void missingKey(vdb_udf::TableArg &arg, vdb_udf::RowDesc *rd_in)
+    {
+		char emsg[2048];
+
+		if (m_composite)
+			formatRowKey(rd_in, m_key_string);
+		else if (m_key_rescale)
+			pivotFormatNumeric(rd_in->getNumeric(m_pivotParameters.pivotColIdx), m_pivotParameters.pivotColScale, m_key_string);
+		else if (m_string_key)
+		{
+			std::size_t keylen;
+			const char *key = PivotMapTable::readString(rd_in, m_pivotParameters.pivotColIdx, m_pivotParameters.pivotColType, keylen);
+			m_key_string.assign(key, keylen);
+		}
+		else
+			m_map.formatKey(m_key, m_key_string);
+		snprintf(emsg, 2048, "Unexpected failure in finding pivotkey %s in map", m_key_string.c_str());
+		arg.throwError(__func__, emsg);
+    }
+
+    /// Read the PIVOTCOL columns of rd_in into the probe components and look them up.  The string components point
+    /// at the row's bytes.  -1 if the key is not in the map.
+    inline vdb_udf::int_t findComposite(vdb_udf::TableArg &arg, vdb_udf::RowDesc *rd_in)
+    {
+		vdb_udf::int_t numKeyCols = m_pivotParameters.pivotCols.size();
+
+		for (vdb_udf::int_t k = 0; k < numKeyCols; k++)
+		{
+			vdb_udf::ColumnIndex inColIdx = m_pivotParameters.pivotCols[k];
+			vdb_udf::int_t keyType = m_pivotParameters.pivotColTypes[k];
+
+			if (rd_in->isNull(inColIdx))
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "Cant map NULL pivotcolumn reference");
+				arg.throwError(__func__, emsg);
+			}
+			if (PivotMapTable::keyClass(keyType) == PivotKeyString)
+			{
+				std::size_t len;
+				m_probe[k].m_lo = (uint64_t) (uintptr_t) PivotMapTable::readString(rd_in, inColIdx, keyType, len);
+				m_probe[k].m_hi = len;
+			}
+			else
+			{
+				PivotMapTable::readKey(rd_in, inColIdx, keyType, m_probe[k]);
+				if (m_key_rescale && !rescaleKey(m_probe[k], k))
+					return -1;
+			}
+		}
+		return m_map.findcolumnoffset(m_probe);
+    }
+
+    /// Render the PIVOTCOL values of rd_in as "(a, b, ...)" for an error message
+    void formatRowKey(vdb_udf::RowDesc *rd_in, std::string &out)
+    {
+		std::string value;
+
+		out = "(";
+		for (std::size_t k = 0; k < m_pivotParameters.pivotCols.size(); k++)
+		{
+			vdb_udf::ColumnIndex inColIdx = m_pivotParameters.pivotCols[k];
+			vdb_udf::int_t keyType = m_pivotParameters.pivotColTypes[k];
+
+			if (PivotMapTable::keyClass(keyType) == PivotKeyString)
+			{
+				std::size_t len;
+				const char *p = PivotMapTable::readString(rd_in, inColIdx, keyType, len);
+				value.assign(p, len);
+			}
+			else
+			{
+				PivotMapTable::readKey(rd_in, inColIdx, keyType, m_key);
+				PivotMapTable::formatValue(keyType, m_pivotParameters.pivotColScales[k], m_key, value);
+			}
+			out.append(k > 0 ? ", " : "").append(value);
+		}
+		out.append(")");
+    }
+
+    /// Bring numeric key component k to the scale of the map.  False if the key has digits below the map's scale or
+    /// does not fit at it; such a key matches no COLUMN_LIST value.
+    inline vdb_udf::bool_t rescaleKey(PivotKey &key, vdb_udf::int_t k)
+    {
+		vdb_udf::numeric_t value = (vdb_udf::numeric_t) (((__uint128_t) key.m_hi << 64) | key.m_lo);
+
+		if (m_key_scale_div[k] == 1 && m_key_scale_mul[k] == 1)
+			return true;
+		if (m_key_scale_div[k] != 1)
+		{
+			if (value % m_key_scale_div[k] != 0)
+				return false;
+			value /= m_key_scale_div[k];
+		}
+		else if (value > m_key_scale_limit[k] || value < -m_key_scale_limit[k])
+			return false;
+		else
+			value *= m_key_scale_mul[k];
+		key.m_lo = (uint64_t) value;
+		key.m_hi = (uint64_t) (value >> 64);
+		return true;
+    }
+
+    /// Copy a fixed width value, or its NULL, into the output row
+    inline void copyFixed(const PivotCellTarget *target, vdb_udf::RowDesc *rd_in)
+    {
+		switch (target->m_kind)
+		{
+			case PivotCellInt:
+				copyFixedAs<PivotCellInt>(target, rd_in);
+				break;
+			case PivotCellBigInt:
+				copyFixedAs<PivotCellBigInt>(target, rd_in);
+				break;
+			case PivotCellSmallInt:
+				copyFixedAs<PivotCellSmallInt>(target, rd_in);
+				break;
+			case PivotCellDate:
+				copyFixedAs<PivotCellDate>(target, rd_in);
+				break;
+			case PivotCellTimeStamp:
+				copyFixedAs<PivotCellTimeStamp>(target, rd_in);
+				break;
+			case PivotCellFloat4:
+				copyFixedAs<PivotCellFloat4>(target, rd_in);
+				break;
+			case PivotCellFloat8:
+				copyFixedAs<PivotCellFloat8>(target, rd_in);
+				break;
+			case PivotCellNumeric:
+				copyFixedAs<PivotCellNumeric>(target, rd_in);
+				break;
+			default:
+				break;
+		}
+    }
+
+    /// copyFixed for a copy kind known at compile time
+    template <vdb_udf::int_t Kind>
+    inline void copyFixedAs(const PivotCellTarget *target, vdb_udf::RowDesc *rd_in)
+    {
+		if (rd_in->isNull(target->m_in))
+		{
+			m_out_rd->setNull(target->m_out, true);
+			return;
+		}
+		switch (Kind)
+		{
+			case PivotCellInt:
+				m_out_rd->setInt(target->m_out, rd_in->getInt(target->m_in));
+				break;
+			case PivotCellBigInt:
+				m_out_rd->setBigInt(target->m_out, rd_in->getBigInt(target->m_in));
+				break;
+			case PivotCellSmallInt:
+				m_out_rd->setSmallInt(target->m_out, rd_in->getSmallInt(target->m_in));
+				break;
+			case PivotCellDate:
+				m_out_rd->setDate(target->m_out, rd_in->getDate(target->m_in));
+				break;
+			case PivotCellTimeStamp:
+				m_out_rd->setTimeStamp(target->m_out, rd_in->getTimeStamp(target->m_in));
+				break;
+			case PivotCellFloat4:
+				m_out_rd->setFloat4(target->m_out, rd_in->getFloat4(target->m_in));
+				break;
+			case PivotCellFloat8:
+				m_out_rd->setFloat8(target->m_out, rd_in->getFloat8(target->m_in));
+				break;
+			case PivotCellNumeric:
+				m_out_rd->setNumeric(target->m_out, rd_in->getNumeric(target->m_in));
+				break;
+			default:
+				break;
+		}
+    }
+
+    /// Combine one partial row into the cells of the group.  Cell state columns start right after the group
+    /// columns, as a state column followed by a count column per cell.
+    void merge(vdb_udf::TableArg &arg, vdb_udf::RowDesc *rd_in)
+    {
+		vdb_udf::int_t numGrpCols = m_pivotParameters.grpCols.size();
+
+		for (std::size_t cellIdx = 0; cellIdx < m_cells.size(); cellIdx++)
+		{
+			PivotAccumulator &cell = m_cells[cellIdx];
+			vdb_udf::int_t c_coloffset = cellIdx % m_pivotParameters.numpivotValCols;
+			vdb_udf::int_t op = m_pivotParameters.aggregates[c_coloffset];
+			vdb_udf::ColumnIndex stateIdx = numGrpCols + 2 * cellIdx;
+			vdb_udf::bigint_t count;
+
+			// A NULL count means no row landed in this cell on that slice
+			if (rd_in->isNull(stateIdx + 1))
+				continue;
+			count = rd_in->getBigInt(stateIdx + 1);
+			cell.m_rows++;
+			if (op == PivotAggNone)
+			{
+				arg.copyColumnValue(rd_in, stateIdx, m_out_rd, numGrpCols + cellIdx);
+				continue;
+			}
+			if (count == 0 || rd_in->isNull(stateIdx))
+				continue;
+			vdb_udf::bool_t first = (cell.m_count == 0);
+			cell.m_count += count;
+			if (op != PivotAggCount && !combine(cell, op, m_pivotParameters.pivotValColDescs[c_coloffset]->type, rd_in, stateIdx, first))
+				sumOverflow(arg, c_coloffset);
+		}
+    }
+
+    /// Fold the value of PIVOTVAL column c_coloffset of rd_in into its cell.  False if the sum overflows.
+    inline vdb_udf::bool_t accumulate(PivotAccumulator &cell, vdb_udf::int_t c_coloffset, vdb_udf::RowDesc *rd_in)
+    {
+		vdb_udf::ColumnIndex inColIdx = m_pivotParameters.pivotValCols[c_coloffset];
+		vdb_udf::int_t op = m_pivotParameters.aggregates[c_coloffset];
+		vdb_udf::bool_t first;
+
+		cell.m_rows++;
+		if (rd_in->isNull(inColIdx))
+			return true;
+		first = (cell.m_count++ == 0);
+		if (op == PivotAggCount)
+			return true;
+		return combine(cell, op, m_pivotParameters.pivotValColDescs[c_coloffset]->type, rd_in, inColIdx, first);
+    }
+
+    /// OUTPUT 'packed': record the value of PIVOTVAL column c_coloffset of rd_in in its cell.  'none' cells keep the
+    /// text of the last value, 'min' and 'max' cells the text of the winning one.  False if the sum overflows.
+    inline vdb_udf::bool_t pack(vdb_udf::int_t cellIdx, vdb_udf::int_t c_coloffset, vdb_udf::RowDesc *rd_in)
+    {
+		PivotAccumulator &cell = m_cells[cellIdx];
+		vdb_udf::ColumnIndex inColIdx = m_pivotParameters.pivotValCols[c_coloffset];
+		vdb_udf::int_t op = m_pivotParameters.aggregates[c_coloffset];
+		vdb_udf::int_t valType = m_pivotParameters.pivotValColDescs[c_coloffset]->type;
+
+		if (cell.m_rows == 0)
+			m_touched.push_back(cellIdx);
+		if (op != PivotAggNone)
+		{
+			if (!accumulate(cell, c_coloffset, rd_in))
+				return false;
+			if ((op == PivotAggMin || op == PivotAggMax) && !rd_in->isNull(inColIdx) && holds(cell, valType))
+				rd_in->getValueAsString(inColIdx, m_cell_text[cellIdx]);
+			return true;
+		}
+		cell.m_rows++;
+		cell.m_count = rd_in->isNull(inColIdx) ? 0 : 1;
+		if (cell.m_count != 0)
+			rd_in->getValueAsString(inColIdx, m_cell_text[cellIdx]);
+		return true;
+    }
+
+    /// True if the state of a 'min' or 'max' cell equals the value combine() last read
+    inline vdb_udf::bool_t holds(const PivotAccumulator &cell, vdb_udf::int_t valType)
+    {
+		switch (PivotMapTable::keyClass(valType))
+		{
+			case PivotKeyInteger:
+				return cell.m_int == (vdb_udf::bigint_t) m_key.m_lo;
+			case PivotKeyFloat:
+				return memcmp(&cell.m_float, &m_key.m_lo, sizeof(cell.m_float)) == 0;
+			case PivotKeyNumeric:
+				return cell.m_numeric == (vdb_udf::numeric_t) (((__uint128_t) m_key.m_hi << 64) | m_key.m_lo);
+			default:
+				return false;
+		}
+    }
+
+    /// Fold the non-NULL value in column col of row_p into the running state of a cell.  False if a 'sum' or 'avg'
+    /// overflows the bigint or numeric(38) state, which is then left as it was.
+    inline vdb_udf::bool_t combine(PivotAccumulator &cell, vdb_udf::int_t op, vdb_udf::int_t valType, vdb_udf::RowDesc *row_p,
+        vdb_udf::ColumnIndex col, vdb_udf::bool_t first)
+    {
+		vdb_udf::bigint_t myint;
+		vdb_udf::float8_t myfloat8;
+		vdb_udf::numeric_t mynumeric;
+
+		PivotMapTable::readKey(row_p, col, valType, m_key);
+		switch (PivotMapTable::keyClass(valType))
+		{
+			case PivotKeyInteger:
+				myint = (vdb_udf::bigint_t) m_key.m_lo;
+				if (first)
+					cell.m_int = myint;
+				else if (op == PivotAggSum || op == PivotAggAvg)
+					return !__builtin_add_overflow(cell.m_int, myint, &cell.m_int);
+				else if (op == PivotAggMin ? myint < cell.m_int : myint > cell.m_int)
+					cell.m_int = myint;
+				break;
+			case PivotKeyFloat:
+				memcpy(&myfloat8, &m_key.m_lo, sizeof(myfloat8));
+				if (first)
+					cell.m_float = myfloat8;
+				else if (op == PivotAggSum || op == PivotAggAvg)
+					cell.m_float += myfloat8;
+				else if (op == PivotAggMin ? myfloat8 < cell.m_float : myfloat8 > cell.m_float)
+					cell.m_float = myfloat8;
+				break;
+			case PivotKeyNumeric:
+				mynumeric = (vdb_udf::numeric_t) (((__uint128_t) m_key.m_hi << 64) | m_key.m_lo);
+				if (first)
+					cell.m_numeric = mynumeric;
+				else if (op == PivotAggSum || op == PivotAggAvg)
+				{
+					if (mynumeric > 0 ? cell.m_numeric > PIVOT_NUMERIC_MAX - mynumeric : cell.m_numeric < -PIVOT_NUMERIC_MAX - mynumeric)
+						return false;
+					cell.m_numeric += mynumeric;
+				}
+				else if (op == PivotAggMin ? mynumeric < cell.m_numeric : mynumeric > cell.m_numeric)
+					cell.m_numeric = mynumeric;
+				break;
+			default:
+				break;
+		}
+		return true;
+    }
+
+    /// Write the aggregated cells into the output row.  Cells without a value keep the NULL set at group start.
+    /// A partial pivot writes the raw state (the sum for 'avg') and the count column of every cell.
+    void materialize()
+    {
+		vdb_udf::int_t numGrpCols = m_pivotParameters.grpCols.size();
+		vdb_udf::int_t numValCols = m_pivotParameters.numpivotValCols;
+		vdb_udf::bool_t partial = (m_pivotParameters.phase == PivotPhasePartial);
+
+		for (std::size_t cellIdx = 0; cellIdx < m_cells.size(); cellIdx++)
+		{
+			const PivotAccumulator &cell = m_cells[cellIdx];
+			vdb_udf::int_t c_coloffset = cellIdx % numValCols;
+			vdb_udf::int_t op = m_pivotParameters.aggregates[c_coloffset];
+			vdb_udf::int_t valType = m_pivotParameters.pivotValColDescs[c_coloffset]->type;
+			vdb_udf::ColumnIndex thiscolpos = numGrpCols + cellIdx * m_pivotParameters.cellWidth;
+
+			if (cell.m_rows == 0)
+				continue;
+			if (partial)
+			{
+				// 'none' cells hold a copied value; report whether one landed
+				m_out_rd->setBigInt(thiscolpos + 1, op == PivotAggNone ? 1 : cell.m_count);
+				if (op == PivotAggAvg)
+					op = PivotAggSum;
+			}
+			if (op == PivotAggNone)
+				continue;
+			if (op == PivotAggCount)
+			{
+				m_out_rd->setBigInt(thiscolpos, cell.m_count);
+				continue;
+			}
+			if (cell.m_count == 0)
+				continue;
+
+			switch (PivotMapTable::keyClass(valType))
+			{
+				case PivotKeyInteger:
+					if (op == PivotAggSum)
+						m_out_rd->setBigInt(thiscolpos, cell.m_int);
+					else if (op == PivotAggAvg)
+						m_out_rd->setFloat8(thiscolpos, (vdb_udf::float8_t) cell.m_int / cell.m_count);
+					else
+						setInteger(thiscolpos, valType, cell.m_int);
+					break;
+				case PivotKeyFloat:
+					if (op == PivotAggAvg)
+						m_out_rd->setFloat8(thiscolpos, cell.m_float / cell.m_count);
+					else if (op != PivotAggSum && valType == vdb_udf::TypeFloat4)
+						m_out_rd->setFloat4(thiscolpos, (vdb_udf::float4_t) cell.m_float);
+					else
+						m_out_rd->setFloat8(thiscolpos, cell.m_float);
+					break;
+				case PivotKeyNumeric:
+					if (op == PivotAggAvg)
+						m_out_rd->setNumeric(thiscolpos, pivotNumericAvg(cell.m_numeric, cell.m_count));
+					else
+						m_out_rd->setNumeric(thiscolpos, cell.m_numeric);
+					break;
+				default:
+					break;
+			}
+		}
+    }
+
+    /// OUTPUT 'packed': write the populated cells of the group as offset:value text into the column after the group
+    /// columns
+    void materializePacked(vdb_udf::TableArg &arg)
+    {
+		vdb_udf::int_t numGrpCols = m_pivotParameters.grpCols.size();
+		vdb_udf::int_t numValCols = m_pivotParameters.numpivotValCols;
+		std::string value;
+		char buf[64];
+
+		std::sort(m_touched.begin(), m_touched.end());
+		m_packed.clear();
+		for (std::size_t i = 0; i < m_touched.size(); i++)
+		{
+			const PivotAccumulator &cell = m_cells[m_touched[i]];
+			vdb_udf::int_t c_coloffset = m_touched[i] % numValCols;
+			vdb_udf::int_t op = m_pivotParameters.aggregates[c_coloffset];
+			const vdb_udf::Column *valDesc = m_pivotParameters.pivotValColDescs[c_coloffset];
+
+			if (op == PivotAggCount)
+			{
+				snprintf(buf, sizeof(buf), "%lld", (long long) cell.m_count);
+				value = buf;
+			}
+			else if (cell.m_count == 0)
+				continue;
+			else if (op == PivotAggNone || op == PivotAggMin || op == PivotAggMax)
+				value = m_cell_text[m_touched[i]];
+			else
+			{
+				switch (PivotMapTable::keyClass(valDesc->type))
+				{
+					case PivotKeyInteger:
+						if (op == PivotAggSum)
+							snprintf(buf, sizeof(buf), "%lld", (long long) cell.m_int);
+						else
+							snprintf(buf, sizeof(buf), "%.17g", (vdb_udf::float8_t) cell.m_int / cell.m_count);
+						value = buf;
+						break;
+					case PivotKeyFloat:
+						snprintf(buf, sizeof(buf), "%.17g", op == PivotAggSum ? cell.m_float : cell.m_float / cell.m_count);
+						value = buf;
+						break;
+					case PivotKeyNumeric:
+						pivotFormatNumeric(op == PivotAggSum ? cell.m_numeric : pivotNumericAvg(cell.m_numeric, cell.m_count), valDesc->scale, value);
+						break;
+					default:
+						continue;
+				}
+			}
+
+			if (!m_packed.empty())
+				m_packed.push_back(',');
+			snprintf(buf, sizeof(buf), "%u:", m_touched[i]);
+			m_packed.append(buf);
+			for (std::size_t c = 0; c < value.size(); c++)
+			{
+				if (value[c] == ',' || value[c] == '\\')
+					m_packed.push_back('\\');
+				m_packed.push_back(value[c]);
+			}
+		}
+
+		if (m_packed.size() > PIVOT_PACKED_MAX_LEN)
+		{
+			char emsg[256];
+			snprintf(emsg, 256, "packed cells of a group take %lu bytes, more than the %d allowed", (unsigned long) m_packed.size(), PIVOT_PACKED_MAX_LEN);
+			arg.throwError(__func__, emsg);
+		}
+		if (m_packed.empty())
+			m_out_rd->setNull(numGrpCols, true);
+		else
+			m_out_rd->setVarChar(numGrpCols, m_packed.data(), m_packed.size());
+    }
+
+    inline void setInteger(vdb_udf::ColumnIndex col, vdb_udf::int_t coltype, vdb_udf::bigint_t value)
+    {
+		switch (coltype)
+		{
+			case vdb_udf::TypeTimeStamp:
+				m_out_rd->setTimeStamp(col, (vdb_udf::timestamp_t) value);
+				break;
+			case vdb_udf::TypeInt:
+				m_out_rd->setInt(col, (vdb_udf::int_t) value);
+				break;
+			case vdb_udf::TypeDate:
+				m_out_rd->setDate(col, (vdb_udf::date_t) value);
+				break;
+			case vdb_udf::TypeSmallInt:
+				m_out_rd->setSmallInt(col, (vdb_udf::smallint_t) value);
+				break;
+			default:
+				m_out_rd->setBigInt(col, value);
+				break;
+		}
+    }
+
+    /// Output column type of an aggregated PIVOTVAL column
+    static void aggregateColumn(vdb_udf::int_t op, const vdb_udf::Column *in, vdb_udf::int_t &type, vdb_udf::int_t &len,
+        vdb_udf::int_t &precision, vdb_udf::int_t &scale)
+    {
+		type = in->type;
+		len = in->length;
+		precision = in->precision;
+		scale = in->scale;
+
+		if (op == PivotAggCount)
+		{
+			type = vdb_udf::TypeBigInt;
+			len = sizeof(vdb_udf::bigint_t);
+			precision = 0;
+			scale = 0;
+		}
+		else if (op == PivotAggSum || op == PivotAggAvg)
+		{
+			switch (PivotMapTable::keyClass(in->type))
+			{
+				case PivotKeyInteger:
+					type = (op == PivotAggSum) ? vdb_udf::TypeBigInt : vdb_udf::TypeFloat8;
+					len = 8;
+					precision = 0;
+					scale = 0;
+					break;
+				case PivotKeyFloat:
+					type = vdb_udf::TypeFloat8;
+					len = sizeof(vdb_udf::float8_t);
+					break;
+				case PivotKeyNumeric:
+					// Widest numeric so that sums do not overflow the declared precision
+					precision = 38;
+					break;
+				default:
+					break;
+			}
+		}
+    }
+   
+    void flush(vdb_udf::TableArg &arg)
+    {
+        // Nothing to emit if no row has been started
+        if (m_first_time)
+            return;
+        if (m_pivotParameters.packed)
+            materializePacked(arg);
+        else if (!m_cells.empty())
+            materialize();
+        arg.getRowStore().put(m_out_rd);
+    }
+
+    /// True if rd_in has the same group column values as the row being built, which holds them in its
+    /// leading columns.
+    vdb_udf::bool_t sameGroup(vdb_udf::RowDesc *rd_in)
+    {
+		vdb_udf::int_t numGrpCols = m_pivotParameters.grpCols.size();
+
+		for (vdb_udf::int_t grpIdx = 0; grpIdx < numGrpCols; grpIdx++)
+		{
+			vdb_udf::ColumnIndex inColIdx = m_pivotParameters.grpCols[grpIdx];
+			vdb_udf::int_t grpType = m_pivotParameters.grpColTypes[grpIdx];
+			vdb_udf::bool_t innull = rd_in->isNull(inColIdx);
+
+			if (innull != m_out_rd->isNull(grpIdx))
+				return false;
+			if (innull)
+				continue;
+
+			switch (PivotMapTable::keyClass(grpType))
+			{
+				case PivotKeyInteger:
+				case PivotKeyFloat:
+				case PivotKeyNumeric:
+					PivotMapTable::readKey(rd_in, inColIdx, grpType, m_key);
+					PivotMapTable::readKey(m_out_rd, grpIdx, grpType, m_group_key);
+					if (!(m_key == m_group_key))
+						return false;
+					break;
+				default:
+					rd_in->getValueAsString(inColIdx, m_key_string);
+					m_out_rd->getValueAsString(grpIdx, m_group_string);
+					if (m_key_string != m_group_string)
+						return false;
+					break;
+			}
+		}
+		return true;
+    }
+
+    /// Parse 'YYYY-MM-DD' or 'YYYY-MM-DD HH:MI:SS' into microseconds from 2000-01-01
+    static vdb_udf::bool_t parseTimestamp(const std::string &text, vdb_udf::bigint_t &out)
+    {
+		int year, month, day, hour = 0, minute = 0, second = 0, used = 0;
+
+		if (sscanf(text.c_str(), "%4d-%2d-%2d%n", &year, &month, &day, &used) != 3)
+			return false;
+		if (text[used] != '\0')
+		{
+			int timeUsed = 0;
+			if (sscanf(text.c_str() + used, " %2d:%2d:%2d%n", &hour, &minute, &second, &timeUsed) != 3 ||
+				text[used + timeUsed] != '\0')
+				return false;
+		}
+		if (month < 1 || month > 12 || day < 1 || day > calendar::month_length(year, month) ||
+			hour > 23 || minute > 59 || second > 59 || hour < 0 || minute < 0 || second < 0)
+			return false;
+		out = pivotDaysFromCivil(year, month, day) * PIVOT_USECS_PER_DAY +
+			((vdb_udf::bigint_t) hour * 3600 + minute * 60 + second) * PIVOT_USECS_PER_SECOND;
+		return true;
+    }
+
+    static void validate(vdb_udf::TableArg &arg, PivotParameters *pivotParameters, vdb_udf::bool_t start_cmd )
+    {
+        const vdb_udf::NamedParameterValue *npvPivotCol = arg.getNamedParameterValue( NPV_PIVOTCOL );
+        const vdb_udf::NamedParameterValue *npvGrpCol = arg.getNamedParameterValue ( NPV_GROUPCOL );
+		const vdb_udf::NamedParameterValue *npvColQuery = arg.getNamedParameterValue ( NPV_COLQRY );
+		const vdb_udf::NamedParameterValue *npvPivotVal = arg.getNamedParameterValue ( NPV_PIVOTVAL );
+		const vdb_udf::NamedParameterValue *npvLookup = arg.getNamedParameterValue ( NPV_LOOKUP );
+		const vdb_udf::NamedParameterValue *npvGrouping = arg.getNamedParameterValue ( NPV_GROUPING );
+		const vdb_udf::NamedParameterValue *npvAggregate = arg.getNamedParameterValue ( NPV_AGGREGATE );
+		const vdb_udf::NamedParameterValue *npvPhase = arg.getNamedParameterValue ( NPV_PHASE );
+		const vdb_udf::NamedParameterValue *npvColVersion = arg.getNamedParameterValue ( NPV_COLVERSION );
+		const vdb_udf::NamedParameterValue *npvOutput = arg.getNamedParameterValue ( NPV_OUTPUT );
+		const vdb_udf::NamedParameterValue *npvBucket = arg.getNamedParameterValue ( NPV_BUCKET );
+		const vdb_udf::NamedParameterValue *npvBucketBase = arg.getNamedParameterValue ( NPV_BUCKETBASE );
+
+		pivotParameters->phase = PivotPhaseSingle;
+		if (npvPhase != NULL)
+		{
+			std::string phase;
+			if (npvPhase->kindOfParameter() != vdb_udf::npConst)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a string constant", NPV_PHASE );
+				arg.throwError(__func__, emsg);
+			}
+			npvPhase->getValueAsString( phase );
+			if (strcasecmp(phase.c_str(), "partial") == 0)
+				pivotParameters->phase = PivotPhasePartial;
+			else if (strcasecmp(phase.c_str(), "merge") == 0)
+				pivotParameters->phase = PivotPhaseMerge;
+			else if (strcasecmp(phase.c_str(), "single") != 0)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be one of 'single', 'partial' or 'merge'", NPV_PHASE );
+				arg.throwError(__func__, emsg);
+			}
+		}
+		pivotParameters->cellWidth = (pivotParameters->phase == PivotPhasePartial) ? 2 : 1;
+
+		// A merge reads partial rows, which no longer carry the pivot and value columns
+		if (pivotParameters->phase == PivotPhaseMerge)
+		{
+		}
+    	else if (npvPivotCol == NULL)
+    	{
+			char emsg[256];
+			snprintf( emsg, 256, "\'%s\' must be specified.", NPV_PIVOTCOL );
+			arg.throwError(__func__, emsg);
+        }
+        else
+        {
+			if ( npvPivotCol->kindOfParameter() != vdb_udf::npColRef )
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a column reference.", NPV_PIVOTCOL );
+				arg.throwError(__func__, emsg);
+			}
+			else
+			{
+				vdb_udf::ColumnIndexVector cols;
+				npvPivotCol->fillColumnIndexVector( cols );
+				if (cols.empty() || cols.size() > PIVOT_MAX_KEY_COLS)
+				{
+					char emsg[256];
+					snprintf(emsg, 256, "\'%s\' takes 1 to %d columns", NPV_PIVOTCOL, PIVOT_MAX_KEY_COLS );
+					arg.throwError(__func__, emsg);
+				}
+				if (cols.size() > 1 && pivotParameters->phase != PivotPhaseSingle)
+				{
+					char emsg[256];
+					snprintf(emsg, 256, "a multi-column \'%s\' requires \'%s\' 'single'", NPV_PIVOTCOL, NPV_PHASE );
+					arg.throwError(__func__, emsg);
+				}
+				pivotParameters->pivotCols.assign( cols.begin(), cols.end() );
+				pivotParameters->pivotColIdx = cols[0];
+				if (!start_cmd)
+				{
+					pivotParameters->pivotColTypes.clear();
+					pivotParameters->pivotColScales.clear();
+					for (std::size_t k = 0; k < cols.size(); k++)
+					{
+						pivotParameters->pivotColTypes.push_back(arg.getInputColumn(cols[k])->type);
+						pivotParameters->pivotColScales.push_back(arg.getInputColumn(cols[k])->scale);
+					}
+					pivotParameters->pivotColType = pivotParameters->pivotColTypes[0];
+					pivotParameters->pivotColScale = pivotParameters->pivotColScales[0];
+				}
+			}		
+        }
+        if (npvGrpCol == NULL)
+        {
+			char emsg[256];
+			snprintf( emsg, 256, "\'%s\' must be specified.", NPV_GROUPCOL );
+			arg.throwError(__func__, emsg);
+        }
+        else
+        {
+			vdb_udf::ColumnIndexVector cols;
+			npvGrpCol->fillColumnIndexVector( cols );
+			pivotParameters->grpCols.assign( cols.begin(), cols.end() );
+			if (!start_cmd)
+			{
+				pivotParameters->grpColTypes.resize(cols.size());
+				for (std::size_t grpIdx = 0; grpIdx < cols.size(); grpIdx++)
+				{
+					pivotParameters->grpColTypes[grpIdx] = arg.getInputColumn(cols[grpIdx])->type;
+				}
+			}
+        }
+		if (npvColQuery == NULL)
+		{
+			char emsg[256];
+			snprintf( emsg, 256, "\'%s\' must be specified.", NPV_COLQRY );
+			arg.throwError(__func__, emsg);
+		}
+		else
+		{
+			std::string query;
+			npvColQuery->getValueAsString( query );
+			pivotParameters->collistquery.assign( query.data(), query.size() );
+		}
+		if (npvColVersion != NULL)
+		{
+			std::string version;
+			if (npvColVersion->kindOfParameter() != vdb_udf::npConst)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a string constant", NPV_COLVERSION );
+				arg.throwError(__func__, emsg);
+			}
+			npvColVersion->getValueAsString( version );
+			pivotParameters->collistversion.assign( version.data(), version.size() );
+		}
+		if (pivotParameters->phase == PivotPhaseMerge)
+		{
+		}
+		else if (npvPivotVal == NULL )
+		{
+			char emsg[256];
+			snprintf( emsg, 256, "\'%s\' must be specified.", NPV_COLQRY );
+			arg.throwError(__func__, emsg);
+		}
 		else
 		{
-			return(it->second);
+			if (npvPivotVal->kindOfParameter() != vdb_udf::npConst)
+			{
+				vdb_udf::ColumnIndexVector cols;
+				npvPivotVal->fillColumnIndexVector( cols );
+				pivotParameters->pivotValCols.assign( cols.begin(), cols.end() );
+				pivotParameters->numpivotValCols = pivotParameters->pivotValCols.size();
+				if (!start_cmd)
+				{
+					pivotParameters->pivotValColDescs.resize(pivotParameters->numpivotValCols);
+					for (vdb_udf::int_t pvalIdx = 0; pvalIdx < pivotParameters->numpivotValCols; pvalIdx++)
+					{
+						pivotParameters->pivotValColDescs[pvalIdx] = arg.getInputColumn(pivotParameters->pivotValCols[pvalIdx]);
+					}
+				}
+			}
+			else
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a column reference or list of column references", NPV_PIVOTVAL );
+				arg.throwError(__func__, emsg);
+			}	
+		}
+
+		pivotParameters->lookupMode = PivotLookupAuto;
+		if (npvLookup != NULL)
+		{
+			std::string mode;
+			if (npvLookup->kindOfParameter() != vdb_udf::npConst)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a string constant", NPV_LOOKUP );
+				arg.throwError(__func__, emsg);
+			}
+			npvLookup->getValueAsString( mode );
+			if (strcasecmp(mode.c_str(), "auto") == 0)
+				pivotParameters->lookupMode = PivotLookupAuto;
+			else if (strcasecmp(mode.c_str(), "hash") == 0)
+				pivotParameters->lookupMode = PivotLookupHash;
+			else if (strcasecmp(mode.c_str(), "dense") == 0)
+				pivotParameters->lookupMode = PivotLookupDense;
+			else if (strcasecmp(mode.c_str(), "perfect") == 0)
+				pivotParameters->lookupMode = PivotLookupPerfect;
+			else if (strcasecmp(mode.c_str(), "sorted") == 0)
+				pivotParameters->lookupMode = PivotLookupSorted;
+			else
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be one of 'auto', 'hash', 'dense', 'perfect' or 'sorted'", NPV_LOOKUP );
+				arg.throwError(__func__, emsg);
+			}
+		}
+
+		pivotParameters->streamGroups = false;
+		if (npvGrouping != NULL)
+		{
+			std::string mode;
+			if (npvGrouping->kindOfParameter() != vdb_udf::npConst)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a string constant", NPV_GROUPING );
+				arg.throwError(__func__, emsg);
+			}
+			npvGrouping->getValueAsString( mode );
+			if (strcasecmp(mode.c_str(), "stream") == 0)
+				pivotParameters->streamGroups = true;
+			else if (strcasecmp(mode.c_str(), "partition") != 0)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be 'partition' or 'stream'", NPV_GROUPING );
+				arg.throwError(__func__, emsg);
+			}
+		}
+
+		pivotParameters->packed = false;
+		if (npvOutput != NULL)
+		{
+			std::string mode;
+			if (npvOutput->kindOfParameter() != vdb_udf::npConst)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a string constant", NPV_OUTPUT );
+				arg.throwError(__func__, emsg);
+			}
+			npvOutput->getValueAsString( mode );
+			if (strcasecmp(mode.c_str(), "packed") == 0)
+				pivotParameters->packed = true;
+			else if (strcasecmp(mode.c_str(), "wide") != 0)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be 'wide' or 'packed'", NPV_OUTPUT );
+				arg.throwError(__func__, emsg);
+			}
+			if (pivotParameters->packed && pivotParameters->phase != PivotPhaseSingle)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' 'packed' requires \'%s\' 'single'", NPV_OUTPUT, NPV_PHASE );
+				arg.throwError(__func__, emsg);
+			}
+		}
+
+		pivotParameters->bucket = PivotBucketNone;
+		pivotParameters->bucketInterval = 0;
+		pivotParameters->bucketBase = 0;
+		if (npvBucket != NULL)
+		{
+			std::string spec;
+			if (npvBucket->kindOfParameter() != vdb_udf::npConst)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a string constant", NPV_BUCKET );
+				arg.throwError(__func__, emsg);
+			}
+			if (pivotParameters->phase == PivotPhaseMerge || pivotParameters->pivotCols.size() != 1)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' needs a single \'%s\' column", NPV_BUCKET, NPV_PIVOTCOL );
+				arg.throwError(__func__, emsg);
+			}
+			npvBucket->getValueAsString( spec );
+			if (strcasecmp(spec.c_str(), "month") == 0)
+				pivotParameters->bucket = PivotBucketMonth;
+			else
+			{
+				char *end = NULL;
+				long long seconds = strtoll(spec.c_str(), &end, 10);
+				if (spec.empty() || *end != '\0' || seconds <= 0 || seconds > std::numeric_limits<vdb_udf::bigint_t>::max() / PIVOT_USECS_PER_SECOND)
+				{
+					char emsg[256];
+					snprintf(emsg, 256, "\'%s\' must be 'month' or a positive number of seconds", NPV_BUCKET );
+					arg.throwError(__func__, emsg);
+				}
+				pivotParameters->bucket = PivotBucketInterval;
+				pivotParameters->bucketInterval = (vdb_udf::bigint_t) seconds * PIVOT_USECS_PER_SECOND;
+			}
+			if (!start_cmd &&
+				!(pivotParameters->pivotColType == vdb_udf::TypeTimeStamp ||
+				(pivotParameters->pivotColType == vdb_udf::TypeDate && pivotParameters->bucket == PivotBucketMonth)))
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' needs a timestamp \'%s\', or a date one for 'month'", NPV_BUCKET, NPV_PIVOTCOL );
+				arg.throwError(__func__, emsg);
+			}
+		}
+		if (npvBucketBase != NULL)
+		{
+			std::string base;
+			if (npvBucketBase->kindOfParameter() != vdb_udf::npConst || pivotParameters->bucket != PivotBucketInterval)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a string constant and needs an interval \'%s\'", NPV_BUCKETBASE, NPV_BUCKET );
+				arg.throwError(__func__, emsg);
+			}
+			npvBucketBase->getValueAsString( base );
+			if (!parseTimestamp(base, pivotParameters->bucketBase))
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a timestamp 'YYYY-MM-DD[ HH:MI:SS]'", NPV_BUCKETBASE );
+				arg.throwError(__func__, emsg);
+			}
+		}
+
+		pivotParameters->aggregates.assign(pivotParameters->numpivotValCols, PivotAggNone);
+		pivotParameters->aggregating = false;
+		if (npvAggregate != NULL)
+		{
+			std::string spec;
+			std::vector<vdb_udf::int_t> ops;
+			if (npvAggregate->kindOfParameter() != vdb_udf::npConst)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a string constant", NPV_AGGREGATE );
+				arg.throwError(__func__, emsg);
+			}
+			npvAggregate->getValueAsString( spec );
+
+			std::size_t start = 0;
+			while (start <= spec.size())
+			{
+				std::size_t end = spec.find(',', start);
+				if (end == std::string::npos)
+					end = spec.size();
+				std::size_t first = spec.find_first_not_of(" \t", start);
+				std::size_t last = spec.find_last_not_of(" \t", end - 1);
+				std::string name = (first < end && last != std::string::npos && last >= first) ? spec.substr(first, last - first + 1) : "";
+
+				if (strcasecmp(name.c_str(), "none") == 0)
+					ops.push_back(PivotAggNone);
+				else if (strcasecmp(name.c_str(), "sum") == 0)
+					ops.push_back(PivotAggSum);
+				else if (strcasecmp(name.c_str(), "count") == 0)
+					ops.push_back(PivotAggCount);
+				else if (strcasecmp(name.c_str(), "min") == 0)
+					ops.push_back(PivotAggMin);
+				else if (strcasecmp(name.c_str(), "max") == 0)
+					ops.push_back(PivotAggMax);
+				else if (strcasecmp(name.c_str(), "avg") == 0)
+					ops.push_back(PivotAggAvg);
+				else
+				{
+					char emsg[256];
+					snprintf(emsg, 256, "\'%s\' entries must be one of 'none', 'sum', 'count', 'min', 'max' or 'avg'", NPV_AGGREGATE );
+					arg.throwError(__func__, emsg);
+				}
+				start = end + 1;
+			}
+
+			// The partial rows of a merge have one state and one count column per value column and key
+			if (pivotParameters->phase == PivotPhaseMerge)
+			{
+				pivotParameters->numpivotValCols = ops.size();
+				pivotParameters->pivotValCols.resize(ops.size());
+				pivotParameters->pivotValColDescs.resize(ops.size());
+				pivotParameters->aggregates.assign(ops.size(), PivotAggNone);
+				for (vdb_udf::int_t pvalIdx = 0; pvalIdx < pivotParameters->numpivotValCols; pvalIdx++)
+				{
+					pivotParameters->pivotValCols[pvalIdx] = pivotParameters->grpCols.size() + 2 * pvalIdx;
+					if (!start_cmd)
+						pivotParameters->pivotValColDescs[pvalIdx] = arg.getInputColumn(pivotParameters->pivotValCols[pvalIdx]);
+					if (!start_cmd && pivotParameters->pivotValColDescs[pvalIdx] == NULL)
+					{
+						char emsg[256];
+						snprintf(emsg, 256, "the input has too few columns for a partial pivot with %d \'%s\' entries", (int) ops.size(), NPV_AGGREGATE );
+						arg.throwError(__func__, emsg);
+					}
+				}
+			}
+
+			if (ops.size() != 1 && (vdb_udf::int_t) ops.size() != pivotParameters->numpivotValCols)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must list one aggregate or one per \'%s\' column", NPV_AGGREGATE, NPV_PIVOTVAL );
+				arg.throwError(__func__, emsg);
+			}
+			for (vdb_udf::int_t pvalIdx = 0; pvalIdx < pivotParameters->numpivotValCols; pvalIdx++)
+			{
+				vdb_udf::int_t op = ops[ops.size() == 1 ? 0 : pvalIdx];
+				pivotParameters->aggregates[pvalIdx] = op;
+				if (op != PivotAggNone)
+					pivotParameters->aggregating = true;
+				if (!start_cmd && op != PivotAggNone && op != PivotAggCount)
+				{
+					vdb_udf::int_t valType = pivotParameters->pivotValColDescs[pvalIdx]->type;
+					PivotKeyClass valClass = PivotMapTable::keyClass(valType);
+					if (valClass != PivotKeyInteger && valClass != PivotKeyFloat && valClass != PivotKeyNumeric)
+					{
+						char emsg[256];
+						snprintf(emsg, 256, "\'%s\' column %d must be an integer, date, timestamp, float or numeric column for this aggregate", NPV_PIVOTVAL, pvalIdx);
+						arg.throwError(__func__, emsg);
+					}
+					// A sum or average of dates or timestamps would only be a count of days or microseconds
+					if ((op == PivotAggSum || op == PivotAggAvg) && (valType == vdb_udf::TypeDate || valType == vdb_udf::TypeTimeStamp))
+					{
+						char emsg[256];
+						snprintf(emsg, 256, "\'%s\' column %d must be an integer, float or numeric column for 'sum' and 'avg'", NPV_PIVOTVAL, pvalIdx);
+						arg.throwError(__func__, emsg);
+					}
+				}
+			}
+		}
+		else if (pivotParameters->phase == PivotPhaseMerge)
+		{
+			char emsg[256];
+			snprintf(emsg, 256, "\'%s\' must be specified when \'%s\' is 'merge'", NPV_AGGREGATE, NPV_PHASE );
+			arg.throwError(__func__, emsg);
+		}
+    }
+   
+    /// Check that the input of a merge has the layout a partial pivot over the same COLUMN_LIST produces: the
+    /// GROUPCOL columns first, then a state column and a bigint count column for each of rows * value columns cells,
+    /// and nothing after them.  Every cell of a value column shares the state type of the first, which must be what
+    /// the partial pivot emits for its aggregate.
+    static void validateMerge(vdb_udf::TableArg &arg, PivotParameters *pivotParameters, vdb_udf::int_t rows)
+    {
+		vdb_udf::int_t numGrpCols = pivotParameters->grpCols.size();
+		vdb_udf::int_t numValCols = pivotParameters->numpivotValCols;
+		vdb_udf::int_t numCells = rows * numValCols;
+
+		for (vdb_udf::int_t grpIdx = 0; grpIdx < numGrpCols; grpIdx++)
+		{
+			if (pivotParameters->grpCols[grpIdx] != grpIdx)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must name the leading input columns when \'%s\' is 'merge'", NPV_GROUPCOL, NPV_PHASE );
+				arg.throwError(__func__, emsg);
+			}
+		}
+
+		for (vdb_udf::int_t cellIdx = 0; cellIdx < numCells; cellIdx++)
+		{
+			vdb_udf::int_t c_coloffset = cellIdx % numValCols;
+			vdb_udf::ColumnIndex stateIdx = numGrpCols + 2 * cellIdx;
+			const vdb_udf::Column *state = arg.getInputColumn(stateIdx);
+			const vdb_udf::Column *count = arg.getInputColumn(stateIdx + 1);
+			const vdb_udf::Column *first = pivotParameters->pivotValColDescs[c_coloffset];
+
+			if (state == NULL || count == NULL)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "the input has %d columns, a partial pivot of %d keys has %d", stateIdx + (state != NULL), rows, numGrpCols + 2 * numCells);
+				arg.throwError(__func__, emsg);
+			}
+			if (count->type != vdb_udf::TypeBigInt)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "input column %d must be the bigint count of a partial pivot cell", stateIdx + 1);
+				arg.throwError(__func__, emsg);
+			}
+			if (state->type != first->type)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "input column %d must have the type of input column %d, the state of the same value column", stateIdx, numGrpCols + 2 * c_coloffset);
+				arg.throwError(__func__, emsg);
+			}
+		}
+		if (arg.getInputColumn(numGrpCols + 2 * numCells) != NULL)
+		{
+			char emsg[256];
+			snprintf(emsg, 256, "the input has more than the %d columns of a partial pivot of %d keys", numGrpCols + 2 * numCells, rows);
+			arg.throwError(__func__, emsg);
+		}
+
+		// A partial pivot emits a bigint count, a bigint, float8 or numeric sum, and min or max in the value's type
+		for (vdb_udf::int_t c_coloffset = 0; c_coloffset < numValCols; c_coloffset++)
+		{
+			vdb_udf::int_t op = pivotParameters->aggregates[c_coloffset];
+			vdb_udf::int_t type = pivotParameters->pivotValColDescs[c_coloffset]->type;
+			vdb_udf::bool_t fits = true;
+
+			if (op == PivotAggCount)
+				fits = (type == vdb_udf::TypeBigInt);
+			else if (op == PivotAggSum || op == PivotAggAvg)
+				fits = (type == vdb_udf::TypeBigInt || type == vdb_udf::TypeFloat8 || type == vdb_udf::TypeNumeric);
+			if (!fits)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "input column %d does not hold the partial state of \'%s\' entry %d", numGrpCols + 2 * c_coloffset, NPV_AGGREGATE, c_coloffset);
+				arg.throwError(__func__, emsg);
+			}
+		}
+    }
+
+    static void DescribeCmd(vdb_udf::TableArg &arg)
+    { 
+        PivotArena arena;
+        PivotClass::PivotParameters pivotParameters(arena);
+		validate(arg, &pivotParameters, false);
+
+        std::string query(pivotParameters.collistquery.data(), pivotParameters.collistquery.size());
+        std::string version(pivotParameters.collistversion.data(), pivotParameters.collistversion.size());
+        vdb_udf::ColumnIndex outidx = 0;
+		vdb_udf::int_t numGrpCols = pivotParameters.grpCols.size();
+		vdb_udf::ColumnIndex thisidx = 0;
+		vdb_udf::int_t colcount = 0;
+
+		for (vdb_udf::int_t grpIdx = 0; grpIdx < numGrpCols; grpIdx++)
+		{
+			int inColIdx = pivotParameters.grpCols[grpIdx];
+			// Streaming only needs each slice ordered by group; the functor finds the group boundaries
+			if (!pivotParameters.streamGroups)
+				arg.addPartitionByColumn( inColIdx );
+			arg.addOrderByColumn( inColIdx );
+			arg.copyColumnSchema ( inColIdx );
+			outidx++;
+		} 
+
+		// LOOKUP 'sorted' walks the keys of a group in order; out of order keys are still found, only slower
+		if (pivotParameters.lookupMode == PivotLookupSorted && pivotParameters.pivotCols.size() == 1)
+			arg.addOrderByColumn( pivotParameters.pivotColIdx );
+
+		// A partial pivot groups each slice's local rows; the merge redistributes the partial rows
+		if (!pivotParameters.streamGroups && pivotParameters.phase != PivotPhasePartial)
+			arg.setGlobalPartitioning( true );
+	
+        // The first keyCount COLUMN_LIST columns are the key; a merge has no PIVOTCOL and only maps single keys
+        vdb_udf::int_t keyCount = pivotParameters.pivotCols.empty() ? 1 : pivotParameters.pivotCols.size();
+        PivotColumnList::Ptr list = PivotColumnList::get(arg, query, version, pivotParameters.lookupMode, keyCount);
+
+        if ((vdb_udf::int_t) list->m_columns.size() < pivotParameters.numpivotValCols+keyCount)
+        {
+			char emsg[256];
+			snprintf(emsg, 256, "invalid column description query, must have at least %d columns", pivotParameters.numpivotValCols+keyCount);
+            arg.throwError(__func__, emsg); 
+        }
+
+		for (vdb_udf::int_t k = 0; k < keyCount && pivotParameters.phase != PivotPhaseMerge; k++)
+		{
+			if (PivotMapTable::keyClass(list->m_columns[k].type) == PivotKeyNone ||
+				PivotMapTable::keyClass(list->m_columns[k].type) != PivotMapTable::keyClass(pivotParameters.pivotColTypes[k]))
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "invalid column description query, column %d must have the same type family as \'%s\' column %d", k, NPV_PIVOTCOL, k);
+				arg.throwError(__func__, emsg);
+			}
+			if (!PivotMapTable::keyTypesMatch(list->m_columns[k].type, pivotParameters.pivotColTypes[k]))
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "invalid column description query, column %d must be a %s like \'%s\' column %d", k,
+					pivotParameters.pivotColTypes[k] == vdb_udf::TypeFloat4 ? "float4" : "float8", NPV_PIVOTCOL, k);
+				arg.throwError(__func__, emsg);
+			}
+		}
+
+		// A bucketed key is a timestamp for an interval and a date for a month, whatever the PIVOTCOL type
+		if (pivotParameters.bucket != PivotBucketNone &&
+			list->m_columns[0].type != (pivotParameters.bucket == PivotBucketMonth ? vdb_udf::TypeDate : vdb_udf::TypeTimeStamp))
+		{
+			char emsg[256];
+			snprintf(emsg, 256, "invalid column description query, column 0 must be a %s for this \'%s\'",
+				pivotParameters.bucket == PivotBucketMonth ? "date" : "timestamp", NPV_BUCKET);
+			arg.throwError(__func__, emsg);
+		}
+
+		for (vdb_udf::int_t s_colcount = 0; s_colcount < pivotParameters.numpivotValCols; s_colcount++)
+		{
+			if (!(list->m_columns[s_colcount+keyCount].type == vdb_udf::TypeVarChar || list->m_columns[s_colcount+keyCount].type == vdb_udf::TypeBpChar))
+			{
+	    		char emsg[256];
+	    		snprintf(emsg, 256, "invalid column description query, column %d must be a string", s_colcount+keyCount);
+            	arg.throwError(__func__, emsg); 
+			}
+		}
+
+		if (pivotParameters.phase == PivotPhaseMerge)
+			validateMerge(arg, &pivotParameters, list->m_rows);
+
+		// Packed output carries every cell in one column; COLUMN_LIST still defines the offsets
+		if (pivotParameters.packed)
+		{
+			thisidx = arg.addOutputColumn(vdb_udf::TypeVarChar, PIVOT_PACKED_MAX_LEN, true, 0, 0);
+			arg.getOutputColumn(thisidx)->name.assign("cells");
+		}
+
+		for (vdb_udf::int_t row = 0; row < list->m_rows && !pivotParameters.packed; row++)
+		{
+			for (vdb_udf::int_t r_colcount = 0; r_colcount < pivotParameters.numpivotValCols; r_colcount++)
+			{
+				const std::string &val = list->label(row, r_colcount);
+				vdb_udf::int_t outType, outLen, outPrecision, outScale;
+
+				vdb_udf::int_t op = pivotParameters.aggregates[r_colcount];
+
+				// Partial 'avg' cells carry their sum as state
+				if (pivotParameters.phase == PivotPhasePartial && op == PivotAggAvg)
+					op = PivotAggSum;
+				aggregateColumn(op, pivotParameters.pivotValColDescs[r_colcount], outType, outLen, outPrecision, outScale);
+				thisidx = arg.addOutputColumn(outType, outLen,
+				pivotParameters.pivotValColDescs[r_colcount]->nullable || op != PivotAggNone || pivotParameters.phase != PivotPhaseSingle, outPrecision, outScale);
+				arg.getOutputColumn(thisidx)->name.assign(val);
+				if (pivotParameters.phase == PivotPhasePartial)
+				{
+					thisidx = arg.addOutputColumn(vdb_udf::TypeBigInt, sizeof(vdb_udf::bigint_t), true, 0, 0);
+					arg.getOutputColumn(thisidx)->name.assign(val + "_count");
+				}
+			}
+			colcount++;
+		}
+	
+        PivotColumnList::handOff(query, version, pivotParameters.lookupMode, keyCount, list);
+        arg.enableSessionCommands();
+    }
+
+    /// Whether list gives the output columns that DescribeCmd laid out: as many key columns, string labels and one
+    /// output column per row and PIVOTVAL column, named by its label.  The key types are checked in Create.
+    static vdb_udf::bool_t fitsLayout(vdb_udf::TableArg &arg, const PivotParameters &pivotParameters, const PivotColumnList &list)
+    {
+		vdb_udf::int_t keyCount = pivotParameters.pivotCols.empty() ? 1 : pivotParameters.pivotCols.size();
+		vdb_udf::int_t numGrpCols = pivotParameters.grpCols.size();
+		vdb_udf::int_t numValCols = pivotParameters.numpivotValCols;
+		vdb_udf::int_t cellWidth = pivotParameters.cellWidth;
+
+		if (list.m_key_count != keyCount || (vdb_udf::int_t) list.m_columns.size() < numValCols+keyCount || list.m_blob.empty())
+			return false;
+		for (vdb_udf::int_t s_colcount = 0; s_colcount < numValCols; s_colcount++)
+		{
+			if (!(list.m_columns[s_colcount+keyCount].type == vdb_udf::TypeVarChar || list.m_columns[s_colcount+keyCount].type == vdb_udf::TypeBpChar))
+				return false;
+		}
+
+		if (pivotParameters.packed)
+			return arg.getOutputColumn(numGrpCols) != NULL && arg.getOutputColumn(numGrpCols + 1) == NULL;
+		for (vdb_udf::int_t row = 0; row < list.m_rows; row++)
+		{
+			for (vdb_udf::int_t c_coloffset = 0; c_coloffset < numValCols; c_coloffset++)
+			{
+				const vdb_udf::Column *out = arg.getOutputColumn(numGrpCols + (row * numValCols + c_coloffset) * cellWidth);
+				if (out == NULL || out->name != list.label(row, c_coloffset))
+					return false;
+			}
+		}
+		return arg.getOutputColumn(numGrpCols + list.m_rows * numValCols * cellWidth) == NULL;
+    }
+
+    static void StartCmd(vdb_udf::TableArg &arg)
+    {
+        PivotArena arena;
+        PivotMapTable tblMap(arena);    
+        PivotClass::PivotParameters pivotParameters(arena);
+
+		validate(arg, &pivotParameters, true);
+
+        std::string query(pivotParameters.collistquery.data(), pivotParameters.collistquery.size());
+        std::string version(pivotParameters.collistversion.data(), pivotParameters.collistversion.size());
+        vdb_udf::int_t keyCount = pivotParameters.pivotCols.empty() ? 1 : pivotParameters.pivotCols.size();
+        PivotColumnList::Fits fits = [&](const PivotColumnList &list) { return fitsLayout(arg, pivotParameters, list); };
+        tblMap.adopt(PivotColumnList::take(arg, query, version, pivotParameters.lookupMode, keyCount, fits)->m_blob);
+        arg.setSessionData( tblMap ) ;
+    }
+
+    static void ShutdownCmd(vdb_udf::TableArg &/*arg*/)
+    {
+    }
+
+    static void AbortCmd(vdb_udf::TableArg &/*arg*/)
+    {
+    }  
+
+    static void FinalizeCmd(vdb_udf::TableArg &arg)
+    {
+		((PivotClass *)arg.getFunctor())->flush(arg);
+    }
+
+    static void CreateCmd(vdb_udf::TableArg &arg);
+
+    /// A functor specialized for the PIVOTCOL type, and for the PIVOTVAL copy when every column is copied the
+    /// same way.  Merges, composite keys and unusual types get the generic PivotClass.
+    static PivotClass *create(vdb_udf::TableArg &arg, PivotParameters &pivotParameters)
+    {
+		if (pivotParameters.phase != PivotPhaseSingle || pivotParameters.pivotCols.size() != 1)
+			return new PivotClass(arg, pivotParameters);
+
+		switch (pivotParameters.pivotColType)
+		{
+			case vdb_udf::TypeInt:
+				return createFor<vdb_udf::TypeInt>(arg, pivotParameters);
+			case vdb_udf::TypeBigInt:
+				return createFor<vdb_udf::TypeBigInt>(arg, pivotParameters);
+			case vdb_udf::TypeSmallInt:
+				return createFor<vdb_udf::TypeSmallInt>(arg, pivotParameters);
+			case vdb_udf::TypeDate:
+				return createFor<vdb_udf::TypeDate>(arg, pivotParameters);
+			case vdb_udf::TypeTimeStamp:
+				return createFor<vdb_udf::TypeTimeStamp>(arg, pivotParameters);
+			case vdb_udf::TypeNumeric:
+				return createFor<vdb_udf::TypeNumeric>(arg, pivotParameters);
+			case vdb_udf::TypeFloat4:
+				return createFor<vdb_udf::TypeFloat4>(arg, pivotParameters);
+			case vdb_udf::TypeFloat8:
+				return createFor<vdb_udf::TypeFloat8>(arg, pivotParameters);
+			case vdb_udf::TypeVarChar:
+				return createFor<vdb_udf::TypeVarChar>(arg, pivotParameters);
+			case vdb_udf::TypeBpChar:
+				return createFor<vdb_udf::TypeBpChar>(arg, pivotParameters);
+			default:
+				return new PivotClass(arg, pivotParameters);
+		}
+    }
+
+    /// Pick the PIVOTVAL specialization.  Only the common measure types get one of their own, to bound the number
+    /// of instantiations.
+    template <vdb_udf::int_t KeyType>
+    static PivotClass *createFor(vdb_udf::TableArg &arg, PivotParameters &pivotParameters)
+    {
+		vdb_udf::int_t kind = PivotCellCopy;
+
+		if (!pivotParameters.aggregating && !pivotParameters.packed)
+		{
+			kind = copyKind(pivotParameters.pivotValColDescs[0]->type);
+			for (vdb_udf::int_t pvalIdx = 1; pvalIdx < pivotParameters.numpivotValCols; pvalIdx++)
+			{
+				if (copyKind(pivotParameters.pivotValColDescs[pvalIdx]->type) != kind)
+					kind = PivotCellCopy;
+			}
+		}
+
+		switch (kind)
+		{
+			case PivotCellInt:
+				return new PivotClassFor<KeyType, PivotCellInt>(arg, pivotParameters);
+			case PivotCellBigInt:
+				return new PivotClassFor<KeyType, PivotCellBigInt>(arg, pivotParameters);
+			case PivotCellFloat8:
+				return new PivotClassFor<KeyType, PivotCellFloat8>(arg, pivotParameters);
+			case PivotCellNumeric:
+				return new PivotClassFor<KeyType, PivotCellNumeric>(arg, pivotParameters);
+			default:
+				return new PivotClassFor<KeyType, PivotCellCopy>(arg, pivotParameters);
 		}
     }
+};
 
-    inline vdb_udf::int_t keyCol() {return m_key_col_idx;}
-    inline void setKeyCol(vdb_udf::int_t idx) {m_key_col_idx = idx;}
-    inline std::size_t getMapSize() { return m_map_values.size(); }
-    inline vdb_udf::int_t getPivotValType() { return m_value_type; }
-    inline vdb_udf::int_t getPivotValLen()  { return m_value_len; }
-
-    PivotMapTable()
+/// PivotClass with the per-row path compiled for one PIVOTCOL type and one PIVOTVAL copy kind
+template <vdb_udf::int_t KeyType, vdb_udf::int_t ValueKind>
+class PivotClassFor : public PivotClass
+{
+public:
+    PivotClassFor(vdb_udf::TableArg &arg, PivotParameters &pivotParameters) : PivotClass(arg, pivotParameters)
     {
-        m_key_col_idx = 0;
-        m_value_type = 0;    
-        m_value_len = 0;
-		m_pivotcol_type = 0;
-		m_pivotcol_len = 0;
     }
 
-    ~PivotMapTable()
+    void process(vdb_udf::TableArg &arg, vdb_udf::RowDesc *rd_in)
     {
-        unordered_pmap::iterator it = m_map_values.erase( m_map_values.begin(), m_map_values.end());
+		processAs<KeyType, ValueKind>(arg, rd_in);
     }
 };
 
+inline void PivotClass::CreateCmd(vdb_udf::TableArg &arg)
+{
+    PivotArena arena;
+    PivotClass::PivotParameters pivotParameters(arena);
+	validate(arg, &pivotParameters, false);	
+    arg.assignFunctor( create(arg, pivotParameters) );
+}
 
-class PivotClass : public vdb_udf::TableFunction
+vdb_UDF_VERSION(pivot);
+extern "C" void pivot(vdb_udf::TableArg &arg)
 {
-    PivotMapTable                m_map;
-    typedef std::vector<vdb_udf::Column *> ColumnVector;
-    typedef std::vector<vdb_udf::Column *>::iterator ColumnVectorIterator;
-    typedef struct 
+    switch ( arg.getCommand() )
     {
-		vdb_udf::ColumnIndexVector grpCols;
-		vdb_udf::ColumnIndex pivotColIdx;
-		vdb_udf::int_t pivotColType;
-		vdb_udf::ColumnIndexVector pivotValCols;
-		vdb_udf::int_t numpivotValCols;
-		std::string collistquery;
-		std::vector <vdb_udf::Column *> pivotValColDescs;
-    } PivotParameters;
+        case vdb_udf::Describe:
+            PivotClass::DescribeCmd(arg);
+            break;
+        case vdb_udf::Create:          
+            PivotClass::CreateCmd(arg);            
+            break;
+        case vdb_udf::Finalize:
+			PivotClass::FinalizeCmd(arg);
+            break;
+        case vdb_udf::Destroy:
+            arg.destroyFunctor() ;
+            break;
+        case vdb_udf::Start:
+            PivotClass::StartCmd(arg);
+            break;
+        case vdb_udf::Shutdown:
+            PivotClass::ShutdownCmd(arg);
+            break;
+        case vdb_udf::Abort:
+            PivotClass::AbortCmd(arg);
+            break;
+        default:
+            break;
+    }
+}
+
+/// UNPIVOT streams every input row into one (group columns, key, value) row per non-NULL value column.  Row i of
+/// COLUMN_LIST supplies the key of the i-th PIVOTVAL column through the same PivotMapTable the pivot uses, read in
+/// the other direction: from column position to key.
+class UnpivotClass : public vdb_udf::TableFunction
+{
+    // Declared first so that it outlives everything allocated from it
+    PivotArena                   m_arena;
+    std::shared_ptr<PivotMapTable> m_shared_map;
+    PivotMapTable                &m_map;
+    typedef std::vector<vdb_udf::ColumnIndex, PivotArenaAllocator<vdb_udf::ColumnIndex> > ColumnIndexVector;
+
+    struct UnpivotParameters
+    {
+		ColumnIndexVector grpCols;
+		ColumnIndexVector valCols;
+		PivotArenaString collistquery;
+		PivotArenaString collistversion;
+
+		UnpivotParameters(PivotArena &arena) :
+			grpCols(PivotArenaAllocator<vdb_udf::ColumnIndex>(arena)),
+			valCols(PivotArenaAllocator<vdb_udf::ColumnIndex>(arena)),
+			collistquery(PivotArenaAllocator<char>(arena)),
+			collistversion(PivotArenaAllocator<char>(arena))
+		{
+		}
+    };
+
+    /// One value column to unpivot: where to read it and which map entry holds its key
+    struct UnpivotCell
+    {
+		vdb_udf::ColumnIndex inColIdx;
+		uint32_t entry;
+    };
 
 protected:
-    PivotParameters m_pivotParameters;
-    vdb_udf::bool_t m_first_time;
+    UnpivotParameters m_parameters;
     vdb_udf::RowDesc *m_out_rd;
     vdb_udf::RowStore &m_store;
+    std::vector<UnpivotCell, PivotArenaAllocator<UnpivotCell> > m_cells;
 
-public:  
-    PivotClass(vdb_udf::TableArg &arg, PivotParameters &pivotParameters) : m_store(arg.getRowStore()), m_first_time(true), m_pivotParameters(pivotParameters)
+public:
+    UnpivotClass(vdb_udf::TableArg &arg, UnpivotParameters &parameters) : m_shared_map(PivotSharedMap::acquire(arg)), m_map(*m_shared_map), m_parameters(m_arena), m_store(arg.getRowStore()),
+        m_cells(PivotArenaAllocator<UnpivotCell>(m_arena))
     {
+        m_parameters = parameters;
         m_out_rd = m_store.alloc();
-        arg.getSessionData(m_map);
+        if (!m_map.isValid())
+        {
+            char emsg[256];
+            snprintf(emsg, 256, "pivot key map session data is damaged or from an incompatible version");
+            arg.throwError(__func__, emsg);
+        }
+
+        // Map entries are in COLUMN_LIST order, so the cells walk the input columns in PIVOTVAL order
+        m_cells.reserve(m_map.getMapSize());
+        for (uint32_t e = 0; e < m_map.getMapSize(); e++)
+        {
+            UnpivotCell cell;
+            vdb_udf::int_t position = m_map.m_positions[e];
+            if (position < 0 || position >= (vdb_udf::int_t) m_parameters.valCols.size())
+                continue;
+            cell.inColIdx = m_parameters.valCols[position];
+            cell.entry = e;
+            m_cells.push_back(cell);
+        }
     }
 
-    ~PivotClass()
+    ~UnpivotClass()
     {
         m_store.free(m_out_rd);
     }
 
+    /// The group columns are written once per input row; each emitted row only overwrites the key and value.
     void process(vdb_udf::TableArg &arg, vdb_udf::RowDesc *rd_in)
     {
-		vdb_udf::ColumnIndex outIdx = 0;
-		vdb_udf::int_t numGrpCols = m_pivotParameters.grpCols.size();
-		std::string key ; 
-		std::ostringstream keycvt;
-		vdb_udf::timestamp_t mytimestamp;
-		vdb_udf::bigint_t mybigint;
-		vdb_udf::numeric_t mynumeric;
-		vdb_udf::int_t myint;
-		vdb_udf::date_t mydate;
-		vdb_udf::smallint_t mysmallint;
-		vdb_udf::float4_t myfloat4;
-		vdb_udf::float8_t myfloat8;
-		vdb_udf::bool_t convert_final = true;
-
-		if (m_first_time)
-		{
-// output the grouping columns
-			for (vdb_udf::int_t grpIdx = 0; grpIdx < numGrpCols; grpIdx++)
-			{
-				int inColIdx = m_pivotParameters.grpCols[grpIdx];
-				arg.copyColumnValue( rd_in, inColIdx, m_out_rd, outIdx);
-				outIdx++;
-			}
-// set all pivoted elements to null initially
-			for (vdb_udf::int_t j = 0; j < (m_map.getMapSize() * m_pivotParameters.numpivotValCols); j++)
-            {		
-				m_out_rd->setNull(outIdx++, true);
-			}
-			m_first_time = false;
-		} 
-	
-		outIdx = numGrpCols;
+		vdb_udf::int_t numGrpCols = m_parameters.grpCols.size();
+		vdb_udf::ColumnIndex keyIdx = numGrpCols;
+		vdb_udf::ColumnIndex valIdx = numGrpCols + 1;
 
-		if (rd_in->isNull(m_pivotParameters.pivotColIdx))
-		{
-			char emsg[256];
-			snprintf(emsg, 256, "Cant map NULL pivotcolumn reference");
-			arg.throwError(__func__, emsg);
-		}
-		switch(m_pivotParameters.pivotColType)
+		for (vdb_udf::int_t grpIdx = 0; grpIdx < numGrpCols; grpIdx++)
 		{
-			case vdb_udf::TypeTimeStamp:
-				mytimestamp = rd_in->getTimeStamp(m_pivotParameters.pivotColIdx);	
-				keycvt << (vdb_udf::bigint_t) mytimestamp;
-				break;
-            case vdb_udf::TypeBigInt:
-                mybigint = rd_in->getBigInt(m_pivotParameters.pivotColIdx);
-				keycvt << mybigint;
-                break;
-            case vdb_udf::TypeNumeric:
-                mynumeric = rd_in->getNumeric(m_pivotParameters.pivotColIdx);
-				keycvt << (vdb_udf::numeric_t) mynumeric;
-                break;
-            case vdb_udf::TypeInt:
-                myint = rd_in->getInt(m_pivotParameters.pivotColIdx);
-				keycvt << myint;
-                break;
-            case vdb_udf::TypeDate:
-                mydate = rd_in->getDate(m_pivotParameters.pivotColIdx);
-				keycvt << mydate;
-                break;
-            case vdb_udf::TypeSmallInt:
-                mysmallint = rd_in->getSmallInt(m_pivotParameters.pivotColIdx);
-				keycvt << mysmallint;
-                break;
-            case vdb_udf::TypeFloat4:
-                myfloat4 = rd_in->getFloat4(m_pivotParameters.pivotColIdx);
-				keycvt << myfloat4;
-                break;
-            case vdb_udf::TypeFloat8:
-                myfloat8 = rd_in->getFloat8(m_pivotParameters.pivotColIdx);
-				keycvt << myfloat8;
-                break;
-            case vdb_udf::TypeVarChar:
-            case vdb_udf::TypeBpChar:
-                rd_in->getValueAsString(m_pivotParameters.pivotColIdx, key);
-				convert_final = false;
-                break;
-            default:
-                break;
+			arg.copyColumnValue(rd_in, m_parameters.grpCols[grpIdx], m_out_rd, grpIdx);
 		}
 
-		if (convert_final)
-			key = keycvt.str();
-
-		vdb_udf::int_t myoffset = m_map.findcolumnoffset(arg, key);
-		if (myoffset < 0)
+		for (std::size_t cellIdx = 0; cellIdx < m_cells.size(); cellIdx++)
 		{
-			char emsg[2048];
-			snprintf(emsg, 2048, "Unexpected failure in finding pivotkey %s in map", key.c_str());
-			arg.throwError(__func__, emsg);
-		}
-		for (vdb_udf::int_t c_coloffset = 0; c_coloffset < m_pivotParameters.numpivotValCols; c_coloffset++)
-		{
-			vdb_udf::int_t thiscolpos = outIdx+(myoffset*m_pivotParameters.numpivotValCols)+c_coloffset;
-			if (thiscolpos < numGrpCols)
-			{
-				char emsg[256];
-				snprintf(emsg, 256, "Derived offset %d does not map to proper pivot position", thiscolpos);
-				arg.throwError(__func__, emsg);
-			}
-			arg.copyColumnValue(rd_in, m_pivotParameters.pivotValCols[c_coloffset], m_out_rd, thiscolpos);
+			const UnpivotCell &cell = m_cells[cellIdx];
+			if (rd_in->isNull(cell.inColIdx))
+				continue;
+			m_map.writeKey(m_out_rd, keyIdx, cell.entry);
+			arg.copyColumnValue(rd_in, cell.inColIdx, m_out_rd, valIdx);
+			m_store.put(m_out_rd);
 		}
     }
-   
-    void flush(vdb_udf::TableArg &arg)
-    {
-        arg.getRowStore().put(m_out_rd);
-    }
 
-    static void validate(vdb_udf::TableArg &arg, PivotParameters *pivotParameters, vdb_udf::bool_t start_cmd )
+    static void validate(vdb_udf::TableArg &arg, UnpivotParameters *parameters)
     {
-        const vdb_udf::NamedParameterValue *npvPivotCol = arg.getNamedParameterValue( NPV_PIVOTCOL );
         const vdb_udf::NamedParameterValue *npvGrpCol = arg.getNamedParameterValue ( NPV_GROUPCOL );
 		const vdb_udf::NamedParameterValue *npvColQuery = arg.getNamedParameterValue ( NPV_COLQRY );
+		const vdb_udf::NamedParameterValue *npvColVersion = arg.getNamedParameterValue ( NPV_COLVERSION );
 		const vdb_udf::NamedParameterValue *npvPivotVal = arg.getNamedParameterValue ( NPV_PIVOTVAL );
 
-    	if (npvPivotCol == NULL)
-    	{
-			char emsg[256];
-			snprintf( emsg, 256, "\'%s\' must be specified.", NPV_PIVOTCOL );
-			arg.throwError(__func__, emsg);
-        }
-        else
-        {
-			if ( npvPivotCol->kindOfParameter() != vdb_udf::npColRef )
-			{
-				char emsg[256];
-				snprintf(emsg, 256, "\'%s\' must be a column reference.", NPV_PIVOTCOL );
-				arg.throwError(__func__, emsg);
-			}
-			else
-			{
-				pivotParameters->pivotColIdx = npvPivotCol->getColRef();
-				if (!start_cmd)
-				{
-					pivotParameters->pivotColType = arg.getInputColumn(pivotParameters->pivotColIdx)->type;
-				}
-			}		
-        }
         if (npvGrpCol == NULL)
         {
 			char emsg[256];
@@ -381,7 +4070,9 @@ public:
         }
         else
         {
-			npvGrpCol->fillColumnIndexVector( pivotParameters->grpCols );
+			vdb_udf::ColumnIndexVector cols;
+			npvGrpCol->fillColumnIndexVector( cols );
+			parameters->grpCols.assign( cols.begin(), cols.end() );
         }
 		if (npvColQuery == NULL)
 		{
@@ -391,168 +4082,156 @@ public:
 		}
 		else
 		{
-			npvColQuery->getValueAsString( pivotParameters->collistquery );
+			std::string query;
+			npvColQuery->getValueAsString( query );
+			parameters->collistquery.assign( query.data(), query.size() );
+		}
+		if (npvColVersion != NULL)
+		{
+			std::string version;
+			if (npvColVersion->kindOfParameter() != vdb_udf::npConst)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' must be a string constant", NPV_COLVERSION );
+				arg.throwError(__func__, emsg);
+			}
+			npvColVersion->getValueAsString( version );
+			parameters->collistversion.assign( version.data(), version.size() );
 		}
-		if (npvPivotVal == NULL )
+		if (npvPivotVal == NULL || npvPivotVal->kindOfParameter() == vdb_udf::npConst)
 		{
 			char emsg[256];
-			snprintf( emsg, 256, "\'%s\' must be specified.", NPV_COLQRY );
+			snprintf(emsg, 256, "\'%s\' must be a column reference or list of column references", NPV_PIVOTVAL );
 			arg.throwError(__func__, emsg);
 		}
 		else
 		{
-			if (npvPivotVal->kindOfParameter() != vdb_udf::npConst)
-			{
-				npvPivotVal->fillColumnIndexVector( pivotParameters->pivotValCols );
-				pivotParameters->numpivotValCols = pivotParameters->pivotValCols.size();
-				if (!start_cmd)
-				{
-					pivotParameters->pivotValColDescs.reserve(pivotParameters->numpivotValCols);
-					for (vdb_udf::int_t pvalIdx = 0; pvalIdx < pivotParameters->numpivotValCols; pvalIdx++)
-					{
-						pivotParameters->pivotValColDescs[pvalIdx] = arg.getInputColumn(pivotParameters->pivotValCols[pvalIdx]);
-					}
-				}
-			}
-			else
-			{
-				char emsg[256];
-				snprintf(emsg, 256, "\'%s\' must be a column reference or list of column references", NPV_PIVOTVAL );
-				arg.throwError(__func__, emsg);
-			}	
+			vdb_udf::ColumnIndexVector cols;
+			npvPivotVal->fillColumnIndexVector( cols );
+			parameters->valCols.assign( cols.begin(), cols.end() );
 		}
     }
-   
+
     static void DescribeCmd(vdb_udf::TableArg &arg)
-    { 
-        PivotClass::PivotParameters pivotParameters;
-		validate(arg, &pivotParameters, false);
+    {
+        PivotArena arena;
+        UnpivotClass::UnpivotParameters parameters(arena);
+		validate(arg, &parameters);
 
-        vdb_udf::SQLClient sql(arg);
-		vdb_udf::RowDesc *rowp;
-        vdb_udf::ColumnIndex outidx = 0;
-		vdb_udf::int_t numGrpCols = pivotParameters.grpCols.size();
-		vdb_udf::ColumnIndex thisidx = 0;
-		vdb_udf::int_t colcount = 0;
+        std::string query(parameters.collistquery.data(), parameters.collistquery.size());
+        std::string version(parameters.collistversion.data(), parameters.collistversion.size());
+		vdb_udf::int_t numGrpCols = parameters.grpCols.size();
+		vdb_udf::int_t numValCols = parameters.valCols.size();
+		vdb_udf::ColumnIndex thisidx;
 
 		for (vdb_udf::int_t grpIdx = 0; grpIdx < numGrpCols; grpIdx++)
 		{
-			int inColIdx = pivotParameters.grpCols[grpIdx];
-			arg.addPartitionByColumn( inColIdx );
-			arg.addOrderByColumn( inColIdx );
-			arg.copyColumnSchema ( inColIdx );
-			outidx++;
-		} 
+			arg.copyColumnSchema( parameters.grpCols[grpIdx] );
+		}
 
-		arg.setGlobalPartitioning( true );
-	
-        vdb_udf::Schema &schema = sql.open(pivotParameters.collistquery.c_str());
+		// The value column holds every PIVOTVAL column, so it takes the widest length and precision
+		const vdb_udf::Column *valDesc = arg.getInputColumn(parameters.valCols[0]);
+		vdb_udf::int_t valLength = valDesc->length;
+		vdb_udf::int_t valPrecision = valDesc->precision;
+		for (vdb_udf::int_t valIdx = 1; valIdx < numValCols; valIdx++)
+		{
+			const vdb_udf::Column *desc = arg.getInputColumn(parameters.valCols[valIdx]);
+			if (desc->type != valDesc->type || desc->scale != valDesc->scale)
+			{
+				char emsg[256];
+				snprintf(emsg, 256, "\'%s\' columns must all have the same type and scale", NPV_PIVOTVAL);
+				arg.throwError(__func__, emsg);
+			}
+			valLength = std::max(valLength, desc->length);
+			valPrecision = std::max(valPrecision, desc->precision);
+		}
 
-        if (schema.size() < pivotParameters.numpivotValCols+1)
-        {
+		// Only position to key is needed, so the plain hash layout is enough
+        PivotColumnList::Ptr list = PivotColumnList::get(arg, query, version, PivotLookupHash, 1);
+		if (list->m_columns.size() < 1 || PivotMapTable::keyClass(list->m_columns[0].type) == PivotKeyNone)
+		{
 			char emsg[256];
-			snprintf(emsg, 256, "invalid column description query, must have at least %d columns", pivotParameters.numpivotValCols+1);
-            arg.throwError(__func__, emsg); 
-        }
+			snprintf(emsg, 256, "invalid column description query, column 0 must be an integer, date, timestamp, float, numeric or string column");
+			arg.throwError(__func__, emsg);
+		}
+		const PivotColumnList::ColumnDesc &keyDesc = list->m_columns[0];
+		thisidx = arg.addOutputColumn(keyDesc.type, keyDesc.length, true, keyDesc.precision, keyDesc.scale);
+		arg.getOutputColumn(thisidx)->name.assign(keyDesc.name);
+		thisidx = arg.addOutputColumn(valDesc->type, valLength, true, valPrecision, valDesc->scale);
+		arg.getOutputColumn(thisidx)->name.assign("value");
 
-		for (vdb_udf::int_t s_colcount = 0; s_colcount < pivotParameters.numpivotValCols; s_colcount++)
+		if (list->m_rows != numValCols)
 		{
-			if (!(schema.at(s_colcount+1)->type == vdb_udf::TypeVarChar || schema.at(s_colcount+1)->type == vdb_udf::TypeBpChar))
-			{
-	    		char emsg[256];
-	    		snprintf(emsg, 256, "invalid column description query, column %d must be a string", s_colcount+1);
-            	arg.throwError(__func__, emsg); 
-			}
+			char emsg[256];
+			snprintf(emsg, 256, "column description query returned %d keys for %d \'%s\' columns", list->m_rows, numValCols, NPV_PIVOTVAL);
+			arg.throwError(__func__, emsg);
 		}
 
-		while ( (rowp = sql.fetch()) != NULL )
+		// A key names one PIVOTVAL column; a repeated key would leave the column of its later row without a key
+		if (list->m_distinct_keys != list->m_rows)
 		{
-			for (vdb_udf::int_t r_colcount = 0; r_colcount < pivotParameters.numpivotValCols; r_colcount++)
-			{
-				std::string val;
-		
-				thisidx = arg.addOutputColumn(pivotParameters.pivotValColDescs[r_colcount]->type, pivotParameters.pivotValColDescs[r_colcount]->length,
-				pivotParameters.pivotValColDescs[r_colcount]->nullable, pivotParameters.pivotValColDescs[r_colcount]->precision, pivotParameters.pivotValColDescs[r_colcount]->scale);
-				rowp->getValueAsString(r_colcount+1, val);
-				arg.getOutputColumn(thisidx)->name.assign(val);
-			}
-			colcount++;
+			char emsg[256];
+			snprintf(emsg, 256, "column description query returned %d distinct keys for %d \'%s\' columns", list->m_distinct_keys, numValCols, NPV_PIVOTVAL);
+			arg.throwError(__func__, emsg);
 		}
-	
+
+        PivotColumnList::handOff(query, version, PivotLookupHash, 1, list);
         arg.enableSessionCommands();
     }
 
-    static void StartCmd(vdb_udf::TableArg &arg)
+    /// Whether list gives the key column that DescribeCmd laid out and one distinct key per PIVOTVAL column
+    static vdb_udf::bool_t fitsLayout(vdb_udf::TableArg &arg, const UnpivotParameters &parameters, const PivotColumnList &list)
     {
-        vdb_udf::SQLClient sql(arg);
-        PivotMapTable tblMap;    
-        PivotClass::PivotParameters pivotParameters;
-		vdb_udf::int_t coloffset = 0;
-        vdb_udf::RowDesc *rowp;
-
-		validate(arg, &pivotParameters, true);
-
-        vdb_udf::Schema &schema = sql.open(pivotParameters.collistquery.c_str());
-        vdb_udf::Column *val_col_p = schema.at(0);
-
-        tblMap.setPivotColType(val_col_p->type, val_col_p->length);
-
-        while ( (rowp = sql.fetch()) != NULL )
-        {
-            tblMap.add(rowp, coloffset++);
-        }
-
-        sql.close();
+		const vdb_udf::Column *out = arg.getOutputColumn(parameters.grpCols.size());
 
-        arg.setSessionData( tblMap ) ;
+		if (out == NULL || list.m_columns.size() < 1 || list.m_blob.empty() || list.m_rows != (vdb_udf::int_t) parameters.valCols.size() ||
+			list.m_distinct_keys != list.m_rows)
+			return false;
+		const PivotColumnList::ColumnDesc &keyDesc = list.m_columns[0];
+		return out->type == keyDesc.type && out->length == keyDesc.length && out->precision == keyDesc.precision &&
+			   out->scale == keyDesc.scale && out->name == keyDesc.name;
     }
 
-    static void ShutdownCmd(vdb_udf::TableArg &/*arg*/)
+    static void StartCmd(vdb_udf::TableArg &arg)
     {
-    }
+        PivotArena arena;
+        PivotMapTable tblMap(arena);
+        UnpivotClass::UnpivotParameters parameters(arena);
 
-    static void AbortCmd(vdb_udf::TableArg &/*arg*/)
-    {
-    }  
+		validate(arg, &parameters);
 
-    static void FinalizeCmd(vdb_udf::TableArg &arg)
-    {
-		((PivotClass *)arg.getFunctor())->flush(arg);
+        std::string query(parameters.collistquery.data(), parameters.collistquery.size());
+        std::string version(parameters.collistversion.data(), parameters.collistversion.size());
+        PivotColumnList::Fits fits = [&](const PivotColumnList &list) { return fitsLayout(arg, parameters, list); };
+        tblMap.adopt(PivotColumnList::take(arg, query, version, PivotLookupHash, 1, fits)->m_blob);
+        arg.setSessionData( tblMap ) ;
     }
 
     static void CreateCmd(vdb_udf::TableArg &arg)
     {
-        PivotClass::PivotParameters pivotParameters;
-		validate(arg, &pivotParameters, false);	
-        arg.assignFunctor( new PivotClass(arg, pivotParameters) );
-    }  
+        PivotArena arena;
+        UnpivotClass::UnpivotParameters parameters(arena);
+		validate(arg, &parameters);
+        arg.assignFunctor( new UnpivotClass(arg, parameters) );
+    }
 };
 
-vdb_UDF_VERSION(pivot);
-extern "C" void pivot(vdb_udf::TableArg &arg)
+vdb_UDF_VERSION(unpivot);
+extern "C" void unpivot(vdb_udf::TableArg &arg)
 {
     switch ( arg.getCommand() )
     {
         case vdb_udf::Describe:
-            PivotClass::DescribeCmd(arg);
+            UnpivotClass::DescribeCmd(arg);
             break;
-        case vdb_udf::Create:          
-            PivotClass::CreateCmd(arg);            
-            break;
-        case vdb_udf::Finalize:
-			PivotClass::FinalizeCmd(arg);
+        case vdb_udf::Create:
+            UnpivotClass::CreateCmd(arg);
             break;
         case vdb_udf::Destroy:
             arg.destroyFunctor() ;
             break;
         case vdb_udf::Start:
-            PivotClass::StartCmd(arg);
-            break;
-        case vdb_udf::Shutdown:
-            PivotClass::ShutdownCmd(arg);
-            break;
-        case vdb_udf::Abort:
-            PivotClass::AbortCmd(arg);
+            UnpivotClass::StartCmd(arg);
             break;
         default:
             break;